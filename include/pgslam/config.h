@@ -0,0 +1,29 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_CONFIG_H_
+#define PGSLAM_CONFIG_H_
+
+#include <pgslam/pgslam.h>
+
+#include <string>
+
+namespace pgslam {
+
+// the names options are given by in parameters, false if unknown
+bool ParseKeyScanPolicy(const std::string &name, KeyScanPolicy *policy);
+bool ParseAssociation(const std::string &name, Association *association);
+bool ParseMatcher(const std::string &name, Matcher *matcher);
+bool ParsePrediction(const std::string &name, Prediction *prediction);
+bool ParsePrecision(const std::string &name, Precision *precision);
+bool ParseRejection(const std::string &name, Rejection *rejection);
+bool ParseSolver(const std::string &name, Solver *solver);
+
+// one option of a config by its parameter name, e.g. matcher and ndt or
+// tracking_iterations and 50. false if the name or the value is unknown
+bool SetOption(const std::string &key, const std::string &value,
+    SlamConfig *config);
+
+}  // namespace pgslam
+
+#endif  // PGSLAM_CONFIG_H_
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_EVALUATION_H_
+#define PGSLAM_EVALUATION_H_
+
+#include <pgslam/pgslam.h>
+#include <pgslam/grid_map.h>
+#include <pgslam/lidar_simulator.h>
+#include <Eigen/Eigen>
+
+#include <utility>
+#include <vector>
+
+namespace pgslam {
+
+// poses ordered by time stamp, nanoseconds
+typedef std::vector<std::pair<int64_t, Pose2D>> StampedPoses;
+
+// pose at a time stamp, linear between the two poses around it. false
+// outside of the poses or across a gap longer than max_gap
+bool InterpolatePose(const StampedPoses &poses, int64_t time_stamp,
+    int64_t max_gap, Pose2D *pose);
+
+// absolute trajectory error, positions compared after the rigid
+// alignment that fits the estimate best onto the truth
+struct AbsoluteError {
+  AbsoluteError();
+  size_t poses;
+  double rmse;
+  double mean;
+  double max;
+  Pose2D alignment;  // estimate * alignment is in the truth frame
+};
+
+// relative pose error between poses delta meters apart along the truth
+struct RelativeError {
+  RelativeError();
+  size_t pairs;
+  double delta;
+  double translation_rmse;
+  double rotation_rmse;
+};
+
+struct MapQuality {
+  MapQuality();
+  size_t occupied;
+  // observed cells neither clearly free nor clearly occupied, high when
+  // the same wall was drawn at different places
+  double ambiguous_ratio;
+  // only against a known world
+  bool has_truth;
+  double precision;  // occupied cells within tolerance of a true wall
+  double recall;     // seen wall cells with an occupied cell in tolerance
+};
+
+// estimate[i] and truth[i] are at the same time
+AbsoluteError EvaluateAbsolute(const std::vector<Pose2D> &estimate,
+    const std::vector<Pose2D> &truth);
+RelativeError EvaluateRelative(const std::vector<Pose2D> &estimate,
+    const std::vector<Pose2D> &truth, double delta);
+// seen are the world positions the lidar hit, alignment takes the map
+// into the world frame. the world may be null
+MapQuality EvaluateMap(const GridMap &map, const World *world,
+    const std::vector<Eigen::Vector2d> &seen, Pose2D alignment,
+    double tolerance);
+
+}  // namespace pgslam
+
+#endif  // PGSLAM_EVALUATION_H_
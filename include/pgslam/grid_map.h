@@ -0,0 +1,54 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_GRID_MAP_H_
+#define PGSLAM_GRID_MAP_H_
+
+#include <pgslam/pgslam.h>
+#include <Eigen/Eigen>
+
+#include <vector>
+
+namespace pgslam {
+
+// occupancy grid in row major order, -1 unknown, 0 free to 100 occupied
+class GridMap {
+ public:
+  GridMap();
+  GridMap(double resolution, Eigen::Vector2d origin, int width, int height);
+  double resolution() const;
+  Eigen::Vector2d origin() const;
+  int width() const;
+  int height() const;
+  const std::vector<int8_t> & data() const;
+  int8_t at(int x, int y) const;
+  // ray trace one scan, origin and points in the frame of the map
+  void DrawScan(const Eigen::Vector2d &origin, const Eigen::Matrix2Xd &points,
+      double draw_range);
+  // ray trace every lidar of a scan placed at pose from its own mount
+  void DrawScan(const LaserScan &scan, Pose2D pose, double draw_range);
+  // fold in a tile rendered in its own frame, placed at tile_pose
+  void Merge(const GridMap &tile, Pose2D tile_pose);
+  // coarser map whose cells are the max of factor x factor blocks, so an
+  // occupied cell always survives and only all unknown blocks stay unknown
+  GridMap Downsample(int factor) const;
+  // pool again the cells covering [min_x, max_x] x [min_y, max_y] of the
+  // fine map this one was downsampled from
+  void Pool(const GridMap &fine, int factor, int min_x, int min_y,
+      int max_x, int max_y);
+
+ private:
+  void MarkFree(int x, int y);
+  void MarkOccupied(int x, int y);
+
+ private:
+  double resolution_;
+  Eigen::Vector2d origin_;
+  int width_;
+  int height_;
+  std::vector<int8_t> data_;
+};
+
+}  // namespace pgslam
+
+#endif  // PGSLAM_GRID_MAP_H_
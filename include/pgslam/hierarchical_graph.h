@@ -0,0 +1,74 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_HIERARCHICAL_GRAPH_H_
+#define PGSLAM_HIERARCHICAL_GRAPH_H_
+
+#include <pgslam/pgslam.h>
+#include <Eigen/Eigen>
+
+#include <utility>
+#include <vector>
+
+namespace pgslam {
+
+// two level pose graph. nodes are grouped by id into clusters of
+// consecutive nodes, each expressed in the frame of its anchor node.
+// the top level only holds one node per cluster, linked by the
+// constraints that cross clusters condensed onto the anchors, so a loop
+// closure moves whole clusters without solving the full graph. a cluster
+// is refined on its own, with its anchor fixed, only after it changed.
+class HierarchicalGraph {
+ public:
+  explicit HierarchicalGraph(size_t cluster_size);
+  void AddPose2dFactor(size_t node_id, Pose2D pose, double cov);
+  void AddPose2dPose2dFactor(size_t node_id_ref,
+      size_t node_id, Pose2D pose, double cov);
+  void remove(size_t node_id);
+  std::vector<std::pair<size_t, Pose2D>> nodes() const;
+  std::vector<std::pair<Eigen::Vector2d, Eigen::Vector2d>> factors() const;
+  size_t cluster_size() const;
+  size_t cluster_count() const;
+  void Optimization();
+
+ private:
+  struct Constraint {
+    size_t ref;
+    size_t node;
+    Pose2D pose;
+    double cov;
+    bool unary;
+    bool active;
+  };
+
+  struct Cluster {
+    Cluster();
+    size_t anchor;
+    // world pose of the anchor
+    Pose2D pose;
+    std::vector<size_t> members;
+    // indices of the constraints with both ends in this cluster
+    std::vector<size_t> constraints;
+    bool dirty;
+  };
+
+  bool has_node(size_t node_id) const;
+  Pose2D NodePose(size_t node_id) const;
+  void InsertNode(size_t node_id, Pose2D pose);
+  void RefineCluster(Cluster *cluster);
+  void OptimizeClusters();
+
+ private:
+  size_t cluster_size_;
+  std::vector<Constraint> constraints_;
+  std::vector<Cluster> clusters_;
+  // per node id, cluster index or -1, and pose in the anchor frame
+  std::vector<int> node_cluster_;
+  std::vector<Pose2D> node_offset_;
+  // the top level has to be solved again
+  bool top_dirty_;
+};
+
+}  // namespace pgslam
+
+#endif  // PGSLAM_HIERARCHICAL_GRAPH_H_
@@ -0,0 +1,508 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_ICP_ENGINE_H_
+#define PGSLAM_ICP_ENGINE_H_
+
+#include <pgslam/pgslam.h>
+#include <pgslam/nn_search.h>
+#include <pgslam/thread_pool.h>
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+// point to point icp put together at compile time from a correspondence,
+// a rejection and a solver policy. no policy call goes through a virtual
+// or a switch, so every combination is a loop of its own. the default
+// combinations are prebuilt in icp_engine.cc, Match picks one at run time
+namespace pgslam {
+namespace icp {
+
+// the point to line solver draws no line shorter than this
+const double kLineMinLength = 1e-6;
+// and damps its steps by this much
+const double kLineDamping = 1e-3;
+// step below which a match counts as converged, unless the budget sets one
+const double kMinStep = 1e-3;
+// query points per chunk of the per point loops. the sums are reduced
+// chunk by chunk in order, so they do not depend on the threads
+const size_t kChunkPoints = 256;
+
+// what the engine is built from besides the match config
+struct Geometry {
+  double angle_min;
+  double angle_increment;
+  size_t interpolation;  // reference points per beam
+  ThreadPool *pool;      // null runs every chunk on the calling thread
+};
+
+// pairs of one iteration, a zero weight leaves a pair out
+template <typename Scalar>
+struct Pairs {
+  typedef Eigen::Matrix<Scalar, 2, Eigen::Dynamic> Points;
+  Points points;              // query points in the reference frame
+  Points near;                // their closest reference points
+  std::vector<size_t> index;  // into the reference, kNoMatch if none
+  std::vector<Scalar> weight;
+  size_t reference_size;
+};
+
+// correspondence policies, the final backends let every lookup bind
+// statically
+template <typename Scalar>
+class BruteForceCorrespondence final
+  : public nn_search::BruteForceSearch<Scalar> {
+ public:
+  BruteForceCorrespondence(const MatchConfig &, const Geometry &) {}
+};
+
+template <typename Scalar>
+class GridCorrespondence final : public nn_search::GridSearch<Scalar> {
+ public:
+  GridCorrespondence(const MatchConfig &config, const Geometry &)
+    : nn_search::GridSearch<Scalar>(config.dist_threshold) {}
+};
+
+template <typename Scalar>
+class KDTreeCorrespondence final : public nn_search::KDTreeSearch<Scalar> {
+ public:
+  KDTreeCorrespondence(const MatchConfig &, const Geometry &) {}
+};
+
+template <typename Scalar>
+class ProjectiveCorrespondence final
+  : public nn_search::ProjectiveSearch<Scalar> {
+ public:
+  ProjectiveCorrespondence(const MatchConfig &config,
+      const Geometry &geometry)
+    : nn_search::ProjectiveSearch<Scalar>(geometry.angle_min,
+        geometry.angle_increment, geometry.interpolation,
+        config.projective_window) {}
+};
+
+// rejection policies
+
+// query points sharing their reference point with more than max_shared
+// others are left out, mostly the far side of an occlusion
+template <typename Scalar>
+class DuplicateRejection {
+ public:
+  DuplicateRejection(const MatchConfig &config, const Geometry &)
+    : max_shared_(config.max_shared) {}
+
+  void Reject(Pairs<Scalar> *pairs) const {
+    std::vector<int> shared(pairs->reference_size, 0);
+    for (size_t i = 0; i < pairs->index.size(); i++)
+      if (pairs->index[i] != nn_search::kNoMatch) shared[pairs->index[i]]++;
+    for (size_t i = 0; i < pairs->index.size(); i++) {
+      if (pairs->index[i] == nn_search::kNoMatch) continue;
+      if (shared[pairs->index[i]] <= max_shared_) continue;
+      pairs->weight[i] = 0;
+      pairs->near.col(i) = pairs->points.col(i);
+    }
+  }
+
+ private:
+  int max_shared_;
+};
+
+// the farthest trim_ratio of the pairs left out
+template <typename Scalar>
+class TrimRejection {
+ public:
+  TrimRejection(const MatchConfig &config, const Geometry &)
+    : trim_ratio_(config.trim_ratio) {}
+
+  void Reject(Pairs<Scalar> *pairs) const {
+    size_t trimmed = pairs->points.cols() * trim_ratio_;
+    std::vector<Scalar> max_distance(trimmed, 0.0);
+    std::vector<int>    max_index(trimmed, 0);
+    for (size_t i = 0; i < pairs->points.cols(); i++) {
+      Scalar distance = (pairs->points.col(i) - pairs->near.col(i)).norm();
+      for (size_t j = 1; j < max_distance.size(); j++) {
+        if (distance > max_distance[j]) {
+          max_distance[j-1] = max_distance[j];
+          max_index[j-1] = max_index[j];
+          if (j == max_distance.size()-1) {
+            max_distance[j] = distance;
+            max_index[j] = i;
+          }
+        } else {
+          max_distance[j-1] = distance;
+          max_index[j-1] = i;
+          break;
+        }
+      }
+    }
+    for (size_t i = 1; i < max_index.size(); i++)
+      pairs->weight[max_index[i]] = 0;
+  }
+
+ private:
+  double trim_ratio_;
+};
+
+// huber weights, pairs further apart than match_threshold count less
+template <typename Scalar>
+class RobustRejection {
+ public:
+  RobustRejection(const MatchConfig &config, const Geometry &)
+    : threshold_(config.match_threshold) {}
+
+  void Reject(Pairs<Scalar> *pairs) const {
+    for (size_t i = 0; i < pairs->weight.size(); i++) {
+      if (pairs->weight[i] == 0) continue;
+      Scalar distance = (pairs->points.col(i) - pairs->near.col(i)).norm();
+      if (distance > threshold_)
+        pairs->weight[i] *= threshold_ / distance;
+    }
+  }
+
+ private:
+  Scalar threshold_;
+};
+
+// first one policy, then the other
+template <class First, class Second>
+class ChainRejection {
+ public:
+  ChainRejection(const MatchConfig &config, const Geometry &geometry)
+    : first_(config, geometry), second_(config, geometry) {}
+
+  template <typename Scalar>
+  void Reject(Pairs<Scalar> *pairs) const {
+    first_.Reject(pairs);
+    second_.Reject(pairs);
+  }
+
+ private:
+  First first_;
+  Second second_;
+};
+
+template <typename Scalar>
+using TrimmedRejection =
+  ChainRejection<DuplicateRejection<Scalar>, TrimRejection<Scalar>>;
+template <typename Scalar>
+using WeightedRejection =
+  ChainRejection<DuplicateRejection<Scalar>, RobustRejection<Scalar>>;
+
+// solver policies, the step they return maps the points of the pairs
+// towards their reference points in the reference frame
+
+// mean of the damped pair offsets and of their torque about the centroid,
+// the move doubled to speed up
+template <typename Scalar>
+class HeuristicSolver {
+ public:
+  typedef Eigen::Matrix<Scalar, 2, 1> Point;
+  typedef Eigen::Matrix<Scalar, 2, Eigen::Dynamic> Points;
+  HeuristicSolver(const MatchConfig &, const Geometry &) {}
+  void Prepare(const Points &) {}
+
+  Pose2D Solve(const Pairs<Scalar> &pairs, Scalar weight) const {
+    Point center(0, 0);
+    for (size_t i = 0; i < pairs.points.cols(); i++)
+      if (pairs.weight[i] != 0)
+        center += pairs.weight[i] * pairs.points.col(i);
+    center /= weight;
+
+    Point move(0, 0);
+    Scalar rot = 0;
+    for (size_t i = 0; i < pairs.points.cols(); i++) {
+      Scalar w = pairs.weight[i];
+      if (w == 0) continue;
+      Point delta = pairs.near.col(i) - pairs.points.col(i);
+      Scalar length = delta.norm();
+      if (length > 0) {
+        delta.normalize();
+        delta *= (length < 0.05) ? length : sqrt(length * 20) / 20;
+      }
+      move += w * delta;
+      Point p = pairs.points.col(i) - center;
+      Point q = pairs.near.col(i) - center;
+      if (p.norm() < std::numeric_limits<Scalar>::epsilon() * 2) continue;
+
+      rot += w * (p.x() * q.y() - p.y() * q.x()) / p.norm() / sqrt(p.norm());
+    }
+    move /= weight;
+    rot /= weight;
+
+    // speed up
+    move *= 2.0;
+    return Pose2D(move.x(), move.y(), rot);
+  }
+};
+
+// least squares rigid fit of the pairs, the closed form a 2x2 svd of
+// their cross covariance comes down to
+template <typename Scalar>
+class SVDSolver {
+ public:
+  typedef Eigen::Matrix<Scalar, 2, Eigen::Dynamic> Points;
+  SVDSolver(const MatchConfig &, const Geometry &) {}
+  void Prepare(const Points &) {}
+
+  Pose2D Solve(const Pairs<Scalar> &pairs, Scalar weight) const {
+    Eigen::Vector2d mean_p(0.0, 0.0);
+    Eigen::Vector2d mean_q(0.0, 0.0);
+    for (size_t i = 0; i < pairs.points.cols(); i++) {
+      double w = pairs.weight[i];
+      if (w == 0) continue;
+      mean_p += w * pairs.points.col(i).template cast<double>();
+      mean_q += w * pairs.near.col(i).template cast<double>();
+    }
+    mean_p /= weight;
+    mean_q /= weight;
+    Eigen::Matrix2d cov = Eigen::Matrix2d::Zero();
+    for (size_t i = 0; i < pairs.points.cols(); i++) {
+      double w = pairs.weight[i];
+      if (w == 0) continue;
+      Eigen::Vector2d p = pairs.points.col(i).template cast<double>();
+      Eigen::Vector2d q = pairs.near.col(i).template cast<double>();
+      cov += w * (p - mean_p) * (q - mean_q).transpose();
+    }
+    double angle = atan2(cov(0, 1) - cov(1, 0), cov(0, 0) + cov(1, 1));
+    Eigen::Vector2d shift =
+      mean_q - Eigen::Rotation2D<double>(angle) * mean_p;
+    return Pose2D(shift.x(), shift.y(), angle);
+  }
+};
+
+// gauss newton on the distances of the points to the lines through their
+// reference points, the lines taken along the beams of the reference
+template <typename Scalar>
+class PointToLineSolver {
+ public:
+  typedef Eigen::Matrix<Scalar, 2, Eigen::Dynamic> Points;
+  PointToLineSolver(const MatchConfig &config, const Geometry &geometry)
+    : span_(std::max<size_t>(geometry.interpolation, 1)),
+      max_length_(4.0 * config.dist_threshold) {}
+
+  void Prepare(const Points &reference) {
+    long n = reference.cols();
+    normals_.resize(Eigen::NoChange, n);
+    for (long i = 0; i < n; i++) {
+      long before = std::max<long>(i - span_, 0);
+      long after = std::min<long>(i + span_, n - 1);
+      Eigen::Vector2d tangent =
+        (reference.col(after) - reference.col(before)).template cast<double>();
+      double length = tangent.norm();
+      // no line across a depth jump or on a single point
+      if (length < kLineMinLength || length > max_length_) {
+        normals_.col(i).setZero();
+        continue;
+      }
+      normals_.col(i) = Eigen::Vector2d(-tangent.y(), tangent.x()) / length;
+    }
+  }
+
+  Pose2D Solve(const Pairs<Scalar> &pairs, Scalar) const {
+    Eigen::Matrix3d hessian = Eigen::Matrix3d::Zero();
+    Eigen::Vector3d gradient = Eigen::Vector3d::Zero();
+    for (size_t i = 0; i < pairs.points.cols(); i++) {
+      double w = pairs.weight[i];
+      if (w == 0) continue;
+      Eigen::Vector2d normal = normals_.col(pairs.index[i]);
+      if (normal.isZero()) continue;
+      Eigen::Vector2d p = pairs.points.col(i).template cast<double>();
+      Eigen::Vector2d q = pairs.near.col(i).template cast<double>();
+      Eigen::Vector3d jacobian(normal.x(), normal.y(),
+          normal.y() * p.x() - normal.x() * p.y());
+      hessian += w * jacobian * jacobian.transpose();
+      gradient += w * jacobian * normal.dot(q - p);
+    }
+    // a little damping keeps a corridor from sliding along itself
+    hessian.diagonal().array() += kLineDamping;
+    Eigen::Vector3d step = hessian.ldlt().solve(gradient);
+    return Pose2D(step.x(), step.y(), step.z());
+  }
+
+ private:
+  long span_;
+  double max_length_;
+  Eigen::Matrix2Xd normals_;
+};
+
+template <typename Scalar, class Correspondence, class Rejection,
+         class Solver>
+class Engine {
+ public:
+  typedef Eigen::Matrix<Scalar, 2, 1> Point;
+  typedef Eigen::Matrix<Scalar, 2, Eigen::Dynamic> Points;
+  Engine(const MatchConfig &config, const Geometry &geometry);
+  // initial maps the query into the frame of the reference
+  MatchResult Match(const Points &reference, const Points &query,
+      Pose2D initial, const MatchBudget &budget);
+
+ private:
+  // transform and pair the query points of a chunk, the matched ones
+  int Associate(const Points &reference, const Points &query,
+      const Eigen::Transform<Scalar, 2, Eigen::Affine> &transform,
+      size_t chunk, Pairs<Scalar> *pairs) const;
+  void ForEachChunk(size_t points, std::function<void(size_t)> body) const;
+
+ private:
+  MatchConfig config_;
+  ThreadPool *pool_;
+  Correspondence correspondence_;
+  Rejection rejection_;
+  Solver solver_;
+};
+
+template <typename Scalar, class Correspondence, class Rejection,
+         class Solver>
+Engine<Scalar, Correspondence, Rejection, Solver>::Engine(
+    const MatchConfig &config, const Geometry &geometry)
+  : config_(config), pool_(geometry.pool),
+    correspondence_(config, geometry), rejection_(config, geometry),
+    solver_(config, geometry) {
+}
+
+template <typename Scalar, class Correspondence, class Rejection,
+         class Solver>
+int Engine<Scalar, Correspondence, Rejection, Solver>::Associate(
+    const Points &reference, const Points &query,
+    const Eigen::Transform<Scalar, 2, Eigen::Affine> &transform,
+    size_t chunk, Pairs<Scalar> *pairs) const {
+  size_t begin = chunk * kChunkPoints;
+  size_t size = std::min<size_t>(kChunkPoints, query.cols() - begin);
+  pairs->points.middleCols(begin, size) =
+    transform * query.middleCols(begin, size);
+  pairs->near.middleCols(begin, size) = pairs->points.middleCols(begin, size);
+
+  // search and save nearest point
+  int match_count = 0;
+  for (size_t i = begin; i < begin + size; i++) {
+    Point point = pairs->points.col(i);
+    size_t index = correspondence_.NearestIndex(point);
+    pairs->index[i] = index;
+    pairs->weight[i] = 0;
+    if (index == nn_search::kNoMatch) continue;
+
+    Point closest = reference.col(index);
+    Scalar distance = (point - closest).norm();
+    if (distance < config_.match_threshold)
+      match_count++;
+    if (distance < config_.dist_threshold) {
+      pairs->near.col(i) = closest;
+      pairs->weight[i] = 1;
+    }
+  }
+  return match_count;
+}
+
+template <typename Scalar, class Correspondence, class Rejection,
+         class Solver>
+void Engine<Scalar, Correspondence, Rejection, Solver>::ForEachChunk(
+    size_t points, std::function<void(size_t)> body) const {
+  size_t chunks = (points + kChunkPoints - 1) / kChunkPoints;
+  if (pool_ != NULL && chunks > 1 && config_.parallel_points > 0 &&
+      points >= static_cast<size_t>(config_.parallel_points)) {
+    pool_->ParallelFor(chunks, body);
+    return;
+  }
+  for (size_t chunk = 0; chunk < chunks; chunk++)
+    body(chunk);
+}
+
+template <typename Scalar, class Correspondence, class Rejection,
+         class Solver>
+MatchResult Engine<Scalar, Correspondence, Rejection, Solver>::Match(
+    const Points &reference, const Points &query, Pose2D initial,
+    const MatchBudget &budget) {
+  MatchMonitor monitor(budget, initial, kMinStep);
+  correspondence_.Construct(reference);
+  solver_.Prepare(reference);
+
+  Pairs<Scalar> pairs;
+  pairs.points.resize(Eigen::NoChange, query.cols());
+  pairs.near.resize(Eigen::NoChange, query.cols());
+  pairs.index.resize(query.cols());
+  pairs.weight.resize(query.cols());
+  pairs.reference_size = reference.cols();
+  size_t chunks = (query.cols() + kChunkPoints - 1) / kChunkPoints;
+  std::vector<int> matched(chunks);
+  std::vector<Scalar> weights(chunks);
+  std::vector<double> residuals(chunks);
+
+  // iterate
+  Pose2D pose = initial;
+  while (monitor.Continue()) {
+    Eigen::Transform<Scalar, 2, Eigen::Affine> transform =
+      pose.ToTransform().template cast<Scalar>();
+    ForEachChunk(query.cols(), [&](size_t chunk) {
+      matched[chunk] = Associate(reference, query, transform, chunk, &pairs);
+    });
+    int match_count = 0;
+    for (size_t chunk = 0; chunk < chunks; chunk++)
+      match_count += matched[chunk];
+    double ratio = static_cast<double>(match_count) / pairs.points.cols();
+
+    rejection_.Reject(&pairs);
+
+    ForEachChunk(query.cols(), [&](size_t chunk) {
+      size_t begin = chunk * kChunkPoints;
+      size_t end = std::min<size_t>(begin + kChunkPoints, query.cols());
+      weights[chunk] = 0;
+      residuals[chunk] = 0.0;
+      for (size_t i = begin; i < end; i++) {
+        if (pairs.weight[i] == 0) continue;
+        weights[chunk] += pairs.weight[i];
+        residuals[chunk] += pairs.weight[i] *
+          (pairs.near.col(i) - pairs.points.col(i)).norm();
+      }
+    });
+    Scalar weight = 0;
+    double residual = 0.0;
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+      weight += weights[chunk];
+      residual += residuals[chunk];
+    }
+    if (weight == 0) {
+      std::cout << "Error: no valid point, return best pose." << std::endl;
+      monitor.Fail();
+      break;
+    }
+    if (monitor.Record(pose, ratio, residual / weight))
+      break;
+
+    // update pose
+    Pose2D step = solver_.Solve(pairs, weight);
+    Pose2D pose_delta = pose * step * pose.inverse();
+    pose = pose_delta * pose;
+    if (monitor.Step(pose, pose_delta.pos().norm(), pose_delta.theta()))
+      break;
+  }
+  return monitor.result();
+}
+
+// the engine the association and the match config ask for, kAuto and a
+// projective association without beam angles fall back to the backend
+// nn_search picks for the clouds
+template <typename Scalar>
+MatchResult Match(Association association, const MatchConfig &config,
+    const Geometry &geometry,
+    const Eigen::Matrix<Scalar, 2, Eigen::Dynamic> &reference,
+    const Eigen::Matrix<Scalar, 2, Eigen::Dynamic> &query, Pose2D initial,
+    const MatchBudget &budget);
+
+// the defaults, prebuilt in icp_engine.cc
+extern template class Engine<double, KDTreeCorrespondence<double>,
+       TrimmedRejection<double>, HeuristicSolver<double>>;
+extern template class Engine<double, ProjectiveCorrespondence<double>,
+       TrimmedRejection<double>, HeuristicSolver<double>>;
+extern template class Engine<float, KDTreeCorrespondence<float>,
+       TrimmedRejection<float>, HeuristicSolver<float>>;
+extern template class Engine<float, ProjectiveCorrespondence<float>,
+       TrimmedRejection<float>, HeuristicSolver<float>>;
+
+}  // namespace icp
+}  // namespace pgslam
+
+#endif  // PGSLAM_ICP_ENGINE_H_
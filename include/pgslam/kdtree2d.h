@@ -9,34 +9,45 @@
 
 namespace kd_tree_2d {
 
+// instantiated for float and double in kdtree2d.cc
+template <typename Scalar>
 class Node {
+ public:
+  typedef Eigen::Matrix<Scalar, 2, 1> Point;
  private:
-  Eigen::Vector2d point;
+  Point point;
   int dir;
   size_t index;
   Node *left, *right;
  public:
-  Node(Eigen::Vector2d point, size_t index, int dir);
+  Node(Point point, size_t index, int dir);
   ~Node();
-  Eigen::Vector2d get_point();
-  size_t get_index();
-  void insert(Eigen::Vector2d point, size_t index);
-  Node * Nearest(Eigen::Vector2d point);
+  Point get_point() const;
+  size_t get_index() const;
+  void insert(Point point, size_t index);
+  const Node * Nearest(Point point) const;
 };
 
-class KDTree2D {
+template <typename Scalar>
+class BasicKDTree2D {
+ public:
+  typedef Eigen::Matrix<Scalar, 2, 1> Point;
+  typedef Eigen::Matrix<Scalar, 2, Eigen::Dynamic> Points;
  private:
-  Node *root;
-  void insert(Eigen::Vector2d point, size_t index);
+  Node<Scalar> *root;
+  void insert(Point point, size_t index);
  public:
-  KDTree2D();
-  void Construct(const std::vector<Eigen::Vector2d> &points);
-  void Construct(const Eigen::Matrix2Xd& points);
-  Eigen::Vector2d Nearest(Eigen::Vector2d point);
-  size_t NearestIndex(Eigen::Vector2d point);
-  ~KDTree2D();
+  BasicKDTree2D();
+  void Construct(const std::vector<Point> &points);
+  void Construct(const Points& points);
+  Point Nearest(Point point) const;
+  size_t NearestIndex(Point point) const;
+  ~BasicKDTree2D();
 };
 
+typedef BasicKDTree2D<double> KDTree2D;
+typedef BasicKDTree2D<float> KDTree2Df;
+
 }  // namespace kd_tree_2d
 
 #endif  // PGSLAM_KDTREE2D_H_
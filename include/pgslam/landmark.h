@@ -0,0 +1,29 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_LANDMARK_H_
+#define PGSLAM_LANDMARK_H_
+
+#include <pgslam/pgslam.h>
+#include <Eigen/Eigen>
+
+#include <vector>
+
+namespace pgslam {
+
+// centers of the retro reflective markers a scan hit, in its frame. a
+// marker is a run of neighbouring bright beams of one lidar, no wider
+// than max_size; runs of different lidars or across the seam of a full
+// turn that are that close are one marker. none once the scan released
+std::vector<Eigen::Vector2d> ExtractReflectors(const LaserScan &scan,
+    const LandmarkConfig &config);
+
+// landmark of every reflector seen from pose, the closest one within the
+// gate that no closer reflector took, -1 for a new landmark
+std::vector<int> AssociateReflectors(
+    const std::vector<Eigen::Vector2d> &reflectors, Pose2D pose,
+    const std::vector<Eigen::Vector2d> &landmarks, double gate);
+
+}  // namespace pgslam
+
+#endif  // PGSLAM_LANDMARK_H_
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_LIDAR_SIMULATOR_H_
+#define PGSLAM_LIDAR_SIMULATOR_H_
+
+#include <pgslam/pgslam.h>
+#include <Eigen/Eigen>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace pgslam {
+
+// occupied cells of a planar world that simulated beams are cast into
+class World {
+ public:
+  World();
+  World(double resolution, Eigen::Vector2d origin, int width, int height);
+  // a map_server yaml and its pgm image, false if either cannot be read
+  static bool Load(const std::string &yaml, World *world);
+  // rooms_x by rooms_y square rooms joined by a door in the middle of
+  // every inner wall, with boxes left at random in their corners. the
+  // waypoints are a loop through every room center
+  static World Generate(int rooms_x, int rooms_y, double room_size,
+      double resolution, unsigned int seed);
+  double resolution() const;
+  Eigen::Vector2d origin() const;
+  int width() const;
+  int height() const;
+  bool occupied(int x, int y) const;
+  void set_occupied(int x, int y, bool occupied);
+  const std::vector<Eigen::Vector2d> & waypoints() const;
+  void set_waypoints(const std::vector<Eigen::Vector2d> &waypoints);
+  // distance to the first occupied cell along a ray, infinity if there
+  // is none within range
+  double Cast(const Eigen::Vector2d &from, double angle, double range) const;
+
+ private:
+  void FillBox(Eigen::Vector2d min, Eigen::Vector2d max);
+
+ private:
+  double resolution_;
+  Eigen::Vector2d origin_;
+  int width_;
+  int height_;
+  std::vector<uint8_t> cells_;
+  std::vector<Eigen::Vector2d> waypoints_;
+};
+
+// closed loop through waypoints, driven at a constant speed and turned
+// in place at every waypoint
+class Trajectory {
+ public:
+  Trajectory(const std::vector<Eigen::Vector2d> &waypoints, double speed,
+      double turn_rate);
+  // seconds per lap
+  double period() const;
+  Pose2D At(double time) const;
+
+ private:
+  struct Leg {
+    double start;  // seconds into the lap
+    Eigen::Vector2d from;
+    double heading;  // before the turn
+    double turn;
+    double length;
+  };
+
+ private:
+  std::vector<Leg> legs_;
+  double speed_;
+  double turn_rate_;
+  double period_;
+};
+
+struct SimulatorConfig {
+  SimulatorConfig();
+  int beams;
+  double rate;            // scans per second
+  // beams are spread evenly over [angle_min, angle_max), so a full
+  // turn has no beam twice
+  double angle_min;
+  double angle_max;
+  double range_max;
+  double range_noise;     // sigma of every range
+  double dropout;         // chance of a beam without return
+  double odometry_noise;  // sigma per meter travelled
+  double heading_noise;   // sigma per radian turned or meter travelled
+  double speed;
+  double turn_rate;
+  unsigned int seed;
+};
+
+struct SimulatedScan {
+  int64_t time_stamp;  // nanoseconds, of the first beam
+  Pose2D truth;        // at the first beam
+  Pose2D odometry;     // drifts away from the truth
+  std::vector<Echo> echos;
+};
+
+// a rotating lidar driven along the waypoints of a world, which must
+// outlive it. beams are fired one after another over the scan period,
+// each from where the robot is by then
+class LidarSimulator {
+ public:
+  LidarSimulator(const World &world, const SimulatorConfig &config);
+  const SimulatorConfig & config() const;
+  const Trajectory & trajectory() const;
+  double angle_increment() const;
+  SimulatedScan Next();
+
+ private:
+  Pose2D Odometry(Pose2D truth);
+
+ private:
+  const World &world_;
+  SimulatorConfig config_;
+  Trajectory trajectory_;
+  std::mt19937 random_;
+  size_t count_;
+  Pose2D last_truth_;
+  Pose2D odometry_;
+};
+
+}  // namespace pgslam
+
+#endif  // PGSLAM_LIDAR_SIMULATOR_H_
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_MAP_EXPORT_H_
+#define PGSLAM_MAP_EXPORT_H_
+
+#include <pgslam/grid_map.h>
+#include <Eigen/Eigen>
+
+#include <functional>
+#include <string>
+
+namespace pgslam {
+
+// image formats of an exported map, both with a map_server yaml beside
+enum class MapFormat {
+  kPGM,
+  kPNG,
+};
+
+// saves a map too large to hold at once. the map is asked for one band of
+// rows at a time, top of the image (largest y) first, and each band is
+// written out before the next one is rendered
+class MapExporter {
+ public:
+  MapExporter(double resolution, Eigen::Vector2d origin,
+      int width, int height);
+  void set_band_rows(int band_rows);
+  // render draws into a band whose origin and size are already set.
+  // writes base.pgm or base.png and base.yaml
+  bool Export(const std::string &base, MapFormat format,
+      const std::function<void(GridMap *band)> &render) const;
+
+ private:
+  bool WriteYaml(const std::string &base, const std::string &image) const;
+
+ private:
+  double resolution_;
+  Eigen::Vector2d origin_;
+  int width_;
+  int height_;
+  int band_rows_;
+};
+
+}  // namespace pgslam
+
+#endif  // PGSLAM_MAP_EXPORT_H_
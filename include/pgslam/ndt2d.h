@@ -0,0 +1,47 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_NDT2D_H_
+#define PGSLAM_NDT2D_H_
+
+#include <pgslam/pgslam.h>
+#include <Eigen/Eigen>
+
+#include <vector>
+
+namespace pgslam {
+
+// normal distributions transform of a point cloud on a regular grid
+class NDTGrid {
+ public:
+  explicit NDTGrid(double resolution);
+  void Construct(const Eigen::Matrix2Xd &points);
+  // newton optimization of the pose mapping points into the grid frame
+  MatchResult Match(const Eigen::Matrix2Xd &points, Pose2D pose,
+      const MatchBudget &budget) const;
+  double resolution() const;
+  size_t valid_cells() const;
+
+ private:
+  struct Cell {
+    Eigen::Vector2d mean;
+    Eigen::Matrix2d information;
+    bool valid;
+  };
+  int CellIndex(int x, int y) const;
+  // score is minus the sum of the densities at the transformed points
+  double Evaluate(const Eigen::Matrix2Xd &points, const Eigen::Vector3d &pose,
+      Eigen::Vector3d *gradient, Eigen::Matrix3d *hessian,
+      int *match_count) const;
+
+ private:
+  double resolution_;
+  Eigen::Vector2d origin_;
+  int width_;
+  int height_;
+  std::vector<Cell, Eigen::aligned_allocator<Cell>> cells_;
+};
+
+}  // namespace pgslam
+
+#endif  // PGSLAM_NDT2D_H_
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_NN_SEARCH_H_
+#define PGSLAM_NN_SEARCH_H_
+
+#include <pgslam/kdtree2d.h>
+#include <Eigen/Eigen>
+
+#include <memory>
+#include <vector>
+
+// every backend is instantiated for float and double in nn_search.cc, the
+// float ones halve the memory traffic of the icp hot loop
+namespace nn_search {
+
+// returned by NearestIndex when no point lies within the gate
+const size_t kNoMatch = static_cast<size_t>(-1);
+
+// common interface of the nearest neighbour backends used by icp
+template <typename Scalar>
+class NearestSearch {
+ public:
+  typedef Eigen::Matrix<Scalar, 2, 1> Point;
+  typedef Eigen::Matrix<Scalar, 2, Eigen::Dynamic> Points;
+  virtual ~NearestSearch() {}
+  virtual void Construct(const Points &points) = 0;
+  virtual size_t NearestIndex(const Point &point) const = 0;
+};
+
+// linear scan over a structure of arrays, vectorized by eigen
+template <typename Scalar>
+class BruteForceSearch : public NearestSearch<Scalar> {
+ public:
+  typedef typename NearestSearch<Scalar>::Point Point;
+  typedef typename NearestSearch<Scalar>::Points Points;
+  void Construct(const Points &points);
+  size_t NearestIndex(const Point &point) const;
+ private:
+  Eigen::Array<Scalar, Eigen::Dynamic, 1> xs_;
+  Eigen::Array<Scalar, Eigen::Dynamic, 1> ys_;
+};
+
+// uniform grid hash, cells stored as one flat index array per cell range
+template <typename Scalar>
+class GridSearch : public NearestSearch<Scalar> {
+ public:
+  typedef typename NearestSearch<Scalar>::Point Point;
+  typedef typename NearestSearch<Scalar>::Points Points;
+  explicit GridSearch(double gate);
+  void Construct(const Points &points);
+  size_t NearestIndex(const Point &point) const;
+  static size_t CellCount(const Points &points, double gate);
+ private:
+  Scalar gate_;
+  Scalar cell_;
+  int rings_;
+  Point origin_;
+  int width_;
+  int height_;
+  std::vector<size_t> cell_start_;
+  std::vector<size_t> cell_index_;
+  Points points_;  // the finite ones
+  std::vector<size_t> index_;  // of each in the cloud it was built from
+};
+
+template <typename Scalar>
+class KDTreeSearch : public NearestSearch<Scalar> {
+ public:
+  typedef typename NearestSearch<Scalar>::Point Point;
+  typedef typename NearestSearch<Scalar>::Points Points;
+  void Construct(const Points &points);
+  size_t NearestIndex(const Point &point) const;
+ private:
+  kd_tree_2d::BasicKDTree2D<Scalar> tree_;
+};
+
+// searches the interpolated points of the beams around the query bearing
+template <typename Scalar>
+class ProjectiveSearch : public NearestSearch<Scalar> {
+ public:
+  typedef typename NearestSearch<Scalar>::Point Point;
+  typedef typename NearestSearch<Scalar>::Points Points;
+  ProjectiveSearch(double angle_min, double angle_increment,
+      size_t interpolate_num, int window);
+  void Construct(const Points &points);
+  size_t NearestIndex(const Point &point) const;
+ private:
+  double angle_min_;
+  double angle_increment_;
+  size_t interpolate_num_;
+  int window_;
+  long beams_;
+  bool full_circle_;
+  Points points_;
+};
+
+enum class Backend {
+  kBruteForce,
+  kGrid,
+  kKDTree,
+};
+
+// pick a backend from reference size, query size and gate radius
+template <typename Scalar>
+Backend SelectBackend(const Eigen::Matrix<Scalar, 2, Eigen::Dynamic> &reference,
+    size_t query_size, double gate);
+
+template <typename Scalar>
+std::unique_ptr<NearestSearch<Scalar>> Create(Backend backend, double gate);
+
+}  // namespace nn_search
+
+#endif  // PGSLAM_NN_SEARCH_H_
@@ -13,6 +13,14 @@
 #include <string>
 #include <utility>
 #include <functional>
+#include <memory>
+#include <chrono>
+#include <deque>
+
+namespace nn_search {
+template <typename Scalar>
+class NearestSearch;
+}  // namespace nn_search
 
 namespace pgslam {
 
@@ -44,7 +52,7 @@ class Echo {
   double range_;
   double angle_;
   double intensity_;
-  int64_t time_stamp_;
+  int64_t time_stamp_;  // nanoseconds
  public:
   Echo(double range, double angle, double intensity, int64_t time_stamp);
   double range() const;
@@ -54,34 +62,241 @@ class Echo {
   Eigen::Vector2d point() const;
 };
 
+class NDTGrid;
+class Submap;
+class HierarchicalGraph;
+class ScanStore;
+class ThreadPool;
+
+// how ICP finds the closest reference point of a query point
+enum class Association {
+  kAuto,        // chosen from cloud size and gate radius
+  kBruteForce,  // vectorized linear scan, best for small clouds
+  kGrid,        // uniform grid hash with cells tied to the gate radius
+  kKDTree,      // generic 2d kd tree over the interpolated reference
+  kProjective,  // bearing lookup into neighbouring beams of the reference
+};
+
+// scan matching engine used for tracking and for graph factors
+enum class Matcher {
+  kICP,   // point to point icp against the interpolated reference
+  kGICP,  // generalized icp, plane to plane on local covariances
+  kNDT,   // newton on the normal distributions transform of the reference
+};
+
+// scalar type of the points in the icp loop, poses are always double
+enum class Precision {
+  kDouble,
+  kFloat,   // half the memory traffic, millimetres are still exact
+};
+
+// how icp weighs its pairs, every one first leaves out the query points
+// sharing a reference point with more than max_shared others
+enum class Rejection {
+  kTrim,       // the farthest trim_ratio of the pairs left out
+  kRobust,     // huber weights beyond match_threshold
+  kDuplicate,  // nothing more
+};
+
+// how icp computes a step from its pairs
+enum class Solver {
+  kHeuristic,    // mean of the damped pair offsets, sped up
+  kSVD,          // least squares rigid fit of the pairs
+  kPointToLine,  // gauss newton on the distances to the reference lines
+};
+
+enum class MatchStatus {
+  kConverged,        // the step or the residual change fell below threshold
+  kBudgetExhausted,  // out of iterations or time, best pose so far returned
+  kDiverged,         // residual blew up or no valid point was left
+};
+
+// limits and convergence thresholds of one scan match
+struct MatchBudget {
+  MatchBudget();
+  int max_iterations;
+  double max_time;             // seconds, non-positive for no limit
+  double min_translation;      // converged when a step moves less ...
+  double min_rotation;         // ... and rotates less than these,
+                               // non-positive for the matcher's own
+  double min_residual_change;  // relative, non-positive to disable
+  double divergence_ratio;     // diverged when residual > ratio * best
+};
+
+// thresholds of the scan matchers
+struct MatchConfig {
+  MatchConfig();
+  double match_threshold;    // pairs closer than this count as matched
+  double dist_threshold;     // pairs further apart are left out
+  int interpolation;         // reference points per beam
+  double trim_ratio;         // share of the farthest icp pairs left out
+  int max_shared;            // icp points sharing more reference left out
+  int projective_window;     // beams searched to either side
+  double covariance_radius;  // gicp neighbourhood of a point
+  double ndt_resolution;
+  Precision precision;
+  Rejection rejection;
+  Solver solver;
+  int parallel_points;       // icp splits its loops from this many points
+};
+
+// retro reflective markers picked out of the key scans by intensity
+struct LandmarkConfig {
+  LandmarkConfig();
+  double intensity;  // returns this bright hit a marker, zero for none
+  int min_points;    // beams a marker is hit by at least
+  double max_size;   // wider bright clusters are surfaces, not markers
+  double gate;       // a marker this close to a landmark sees it again
+  double weight;     // information of a landmark factor per axis
+};
+
+struct MatchResult {
+  MatchResult();
+  Pose2D pose;
+  double ratio;
+  MatchStatus status;
+  int iterations;
+  double residual;
+};
+
+// bookkeeping of an iterative matcher against its budget
+class MatchMonitor {
+ public:
+  // min_step stands in for the step thresholds the budget leaves unset
+  MatchMonitor(const MatchBudget &budget, Pose2D initial, double min_step);
+  // false once the iteration or time budget is used up
+  bool Continue();
+  // residual of the pose an iteration starts from, true to stop
+  bool Record(Pose2D pose, double ratio, double residual);
+  // step of the iteration, true to stop
+  bool Step(Pose2D pose, double translation, double rotation);
+  void Fail();
+  MatchResult result() const;
+
+ private:
+  MatchBudget budget_;
+  std::chrono::steady_clock::time_point start_;
+  MatchResult best_;
+  MatchResult last_;
+  bool stopped_;
+};
+
+typedef std::vector<Eigen::Matrix2d,
+        Eigen::aligned_allocator<Eigen::Matrix2d>> Covariances;
+
+// one lidar of a scan and the points it took, in the order of its beams
+struct Lidar {
+  Lidar();
+  Pose2D mount;  // in the frame of the scan, where its rays start
+  double angle_min;
+  double angle_increment;
+  size_t first;  // index of its first point
+  size_t count;
+};
+
 class LaserScan {
  public:
   explicit LaserScan(std::vector<Echo> echos);
   LaserScan(std::vector<Echo> echos, Pose2D pose);
+  // the echos of several lidars fused into one scan in the frame of the
+  // robot, mounts[k] is where lidar k was at time_stamp
+  LaserScan(const std::vector<std::vector<Echo>> &echos,
+      const std::vector<Pose2D> &mounts, int64_t time_stamp);
   Pose2D pose() const;
   void set_pose(Pose2D pose);
+  int64_t time_stamp() const;
+  Association association() const;
+  void set_association(Association association);
+  void set_projective_window(int projective_window);
+  const MatchConfig & match_config() const;
+  void set_match_config(const MatchConfig &config);
+  // icp of large scans spreads over the pool, null keeps it on one thread
+  void set_thread_pool(ThreadPool *pool);
+  Matcher matcher() const;
+  void set_matcher(Matcher matcher);
   const Eigen::Matrix2Xd& points();
+  const Eigen::Matrix2Xd& local_points() const;
+  // of every point, zero without one. they stay in memory when the
+  // points are released, so a restored scan has them again
+  const Eigen::VectorXd& intensities() const;
+  // one with the whole scan at the origin unless fused
+  const std::vector<Lidar> & lidars() const;
+  // the points can be paged out to a ScanStore and back
+  bool resident() const;
+  void Release();
+  void Restore(const Eigen::Matrix2Xd &points);
+  Pose2D Match(const LaserScan &scan, double *ratio);
+  MatchResult Match(const LaserScan &scan, const MatchBudget &budget);
   Pose2D ICP(const LaserScan &scan, double *ratio);
+  MatchResult ICP(const LaserScan &scan, const MatchBudget &budget);
+  Pose2D GICP(const LaserScan &scan, double *ratio);
+  MatchResult GICP(const LaserScan &scan, const MatchBudget &budget);
+  Pose2D NDT(const LaserScan &scan, double *ratio);
+  MatchResult NDT(const LaserScan &scan, const MatchBudget &budget);
   double max_x_in_world();
   double min_x_in_world();
   double max_y_in_world();
   double min_y_in_world();
 
  private:
+  void Init(std::shared_ptr<const Eigen::Matrix2Xd> points,
+      std::shared_ptr<const Eigen::VectorXd> intensities,
+      const std::vector<Lidar> &lidars, int64_t time_stamp);
   void UpdateToWorld();
+  template <typename Scalar>
+  Eigen::Matrix<Scalar, 2, Eigen::Dynamic> Interpolate(
+      size_t interpolate_num) const;
+  template <typename Scalar>
+  std::unique_ptr<nn_search::NearestSearch<Scalar>> CreateSearch(
+      const Eigen::Matrix<Scalar, 2, Eigen::Dynamic> &reference,
+      size_t interpolate_num, size_t query_size) const;
+  template <typename Scalar>
+  MatchResult ICPKernel(
+      const Eigen::Matrix<Scalar, 2, Eigen::Dynamic> &reference,
+      const Eigen::Matrix<Scalar, 2, Eigen::Dynamic> &query,
+      const LaserScan &scan, const MatchBudget &budget);
+  const Covariances & covariances() const;
+  const NDTGrid & ndt_grid() const;
+  // single precision copies for the float icp, as query and as reference
+  const Eigen::Matrix2Xf & float_points() const;
+  const Eigen::Matrix2Xf & float_reference() const;
 
  private:
-  Eigen::Matrix2Xd points_;
-  Eigen::Matrix2Xd points_world_;
+  // immutable once built, so copies of a scan share them
+  std::shared_ptr<const Eigen::Matrix2Xd> points_;
+  std::shared_ptr<const Eigen::Matrix2Xd> points_world_;
+  std::shared_ptr<const Eigen::VectorXd> intensities_;
+  std::shared_ptr<const std::vector<Lidar>> lidars_;
   Pose2D pose_;
+  int64_t time_stamp_;
   bool world_transformed_flag_;
   double max_x_;
   double min_x_;
   double max_y_;
   double min_y_;
+  // bounding box of the points in the scan frame, kept when released
+  Eigen::Vector2d local_min_;
+  Eigen::Vector2d local_max_;
+  bool resident_;
 
-  double match_threshold_;
-  double dist_threshold_;
+  MatchConfig match_config_;
+
+  // beam geometry, used by projective association, zero when fused
+  double angle_min_;
+  double angle_increment_;
+  Association association_;
+
+  Matcher matcher_;
+  ThreadPool *pool_;
+  // local point covariances in the scan frame, computed once on demand.
+  // the caches are only loaded and stored atomically, since concurrent
+  // matches against the same scan build them from const methods
+  mutable std::shared_ptr<const Covariances> covariances_;
+  // ndt of the reference in the scan frame, computed once on demand
+  mutable std::shared_ptr<const NDTGrid> ndt_grid_;
+  // the points and their interpolation in float, computed once on demand
+  mutable std::shared_ptr<const Eigen::Matrix2Xf> float_points_;
+  mutable std::shared_ptr<const Eigen::Matrix2Xf> float_reference_;
 };
 
 
@@ -89,12 +304,23 @@ class LaserScan {
 class GraphSlam {
  public:
   GraphSlam();
+  // nodes per cluster of a two level graph, zero keeps one flat graph
+  void set_cluster_size(size_t cluster_size);
   void AddPose2dFactor(size_t node_id, Pose2D pose_ros, double cov);
   void AddPose2dPose2dFactor(size_t node_id_ref,
       size_t node_id, Pose2D pose_ros, double cov);
+  // a landmark seen at measurement in the frame of a node, a landmark id
+  // one past the last adds a landmark. the flat graph only
+  void AddPose2dPoint2dFactor(size_t node_id, size_t landmark_id,
+      Eigen::Vector2d measurement, double cov);
   void remove(size_t node_id);
   std::vector<std::pair<size_t, Pose2D>> nodes();
   std::vector<std::pair<Eigen::Vector2d, Eigen::Vector2d>> factors();
+  // node ids of every relative factor, in the order they were added
+  const std::vector<std::pair<size_t, size_t>> & edges() const;
+  std::vector<Eigen::Vector2d> landmarks();
+  // node and landmark ids of every landmark factor
+  const std::vector<std::pair<size_t, size_t>> & landmark_edges() const;
   void clear();
   void Optimization();
 
@@ -104,33 +330,147 @@ class GraphSlam {
  private:
   isam::Slam * slam_;
   std::vector<isam::Pose2d_Node*> pose_nodes_;
+  std::vector<std::pair<size_t, size_t>> edges_;
+  std::vector<isam::Point2d_Node*> landmark_nodes_;
+  std::vector<std::pair<size_t, size_t>> landmark_edges_;
+  std::shared_ptr<HierarchicalGraph> hierarchy_;
 };
 #endif
 
+// initial guess of the tracking match
+enum class Prediction {
+  kOdometry,          // odometry composed onto the last corrected pose
+  kConstantVelocity,  // velocity of the recent corrected poses
+  kBlended,           // weighted mix of both motions
+};
+
+// when the tracker turns the current scan into a new key scan
+enum class KeyScanPolicy {
+  kDistance,  // se2 distance to the closest key scan above the threshold
+  kOverlap,   // match ratio against the closest key scan stays too low
+};
+
+typedef std::vector<std::shared_ptr<const LaserScan>> LaserScanHandles;
+typedef std::vector<std::shared_ptr<const Submap>> SubmapHandles;
+
+// immutable view of the slam state, a new one is published after every
+// update. readers on any thread keep theirs for as long as they need it
+struct SlamSnapshot {
+  SlamSnapshot();
+  // a key scan with its points, loaded from the scan store if released
+  LaserScan scan(size_t scan_id) const;
+
+  uint64_t version;      // one more per published snapshot
+  uint64_t map_version;  // one more when key scans, submaps or graph change
+  int64_t time_stamp;
+  Pose2D pose;
+  // shared between snapshots until they change. released scans keep
+  // their pose and bounds but no points, see scan()
+  std::shared_ptr<const LaserScanHandles> scans;
+  std::shared_ptr<const SubmapHandles> submaps;
+  std::shared_ptr<const std::vector<std::pair<size_t, Pose2D>>> graph_nodes;
+  std::shared_ptr<const std::vector<std::pair<size_t, size_t>>> graph_edges;
+  std::shared_ptr<const std::vector<Eigen::Vector2d>> landmarks;
+  // key scan and landmark of every landmark factor
+  std::shared_ptr<const std::vector<std::pair<size_t, size_t>>>
+    landmark_edges;
+  std::shared_ptr<ScanStore> store;
+};
+
+// tuning of a slam, any of it can change between two scans
+struct SlamConfig {
+  SlamConfig();
+  double keyscan_threshold;
+  double factor_threshold;
+  KeyScanPolicy keyscan_policy;
+  double keyscan_overlap;
+  int keyscan_hysteresis;
+  Association association;
+  Matcher matcher;
+  MatchBudget tracking_budget;
+  MatchBudget factor_budget;
+  Prediction prediction;
+  double prediction_blend;
+  MatchConfig match;
+  LandmarkConfig landmark;
+};
+
+// feed from one thread. other threads only read through snapshot()
 class Slam {
  public:
   Slam();
   void set_keyscan_threshold(double keyscan_threshold);
   void set_factor_threshold(double factor_threshold);
+  void set_association(Association association);
+  void set_matcher(Matcher matcher);
+  void set_tracking_budget(const MatchBudget &budget);
+  void set_factor_budget(const MatchBudget &budget);
+  void set_prediction(Prediction prediction);
+  void set_prediction_blend(double blend);
+  void set_keyscan_policy(KeyScanPolicy policy);
+  void set_keyscan_overlap(double overlap);
+  void set_keyscan_hysteresis(int hysteresis);
+  void set_submap_size(size_t submap_size);
+  void set_graph_cluster_size(size_t cluster_size);
+  // shared by the matches of large scans, it has to outlive the slam
+  void set_thread_pool(ThreadPool *pool);
+  const SlamConfig & config() const;
+  void set_config(const SlamConfig &config);
+  // page key scan points out to disk, null keeps them all in memory
+  void set_scan_store(std::shared_ptr<ScanStore> store);
   void UpdatePoseWithPose(Pose2D pose);
   void UpdatePoseWithEncoder(double left, double right, double tread);
   void UpdatePoseWithLaserScan(const LaserScan &scan);
   Pose2D pose() const;
+  // every key scan with its pose and bounds. with a scan store, the ones
+  // paged out have no points and resident() false, scan() loads them
   const std::vector<LaserScan> & scans();
+  // a key scan with its points paged in
+  LaserScan scan(size_t scan_id);
+  const std::vector<std::shared_ptr<Submap>> & submaps() const;
 #ifdef USE_ISAM
   std::vector<std::pair<Eigen::Vector2d, Eigen::Vector2d>> factors();
+  std::vector<std::pair<size_t, Pose2D>> graph_nodes();
+  // relative factors from the first-th on, so callers can append
+  std::vector<std::pair<size_t, size_t>> graph_edges(size_t first) const;
 #endif
+  // latest published state, safe from any thread
+  std::shared_ptr<const SlamSnapshot> snapshot() const;
   void RegisterPoseUpdateCallback(std::function<void(Pose2D)> f);
   void RegisterMapUpdateCallback(std::function<void(void)> f);
 
  private:
   Pose2D EncoderToPose2D(double left, double right, double tread);
+  Pose2D PredictPose(int64_t time_stamp) const;
+  void RecordPose(int64_t time_stamp, bool reset);
+  void AddKeyScan(LaserScan scan, size_t closest);
+  void InsertIntoSubmaps(LaserScan scan);
+#ifdef USE_ISAM
+  // factors to the reflectors of a new key scan, the landmarks seen again
+  size_t AddLandmarkFactors(const LaserScan &scan, size_t scan_id);
+#endif
+  void PushKeyScan(const LaserScan &scan);
+  LaserScan & PagedScan(size_t scan_id);
+  void Publish(bool map_changed);
 
  private:
   std::vector<LaserScan> scans_;
   Pose2D pose_;
-  double keyscan_threshold_;
-  double factor_threshold_;
+  SlamConfig config_;
+  int low_overlap_count_;
+  // recent corrected poses with their scan time stamps
+  std::deque<std::pair<int64_t, Pose2D>> history_;
+  // key scans per submap, zero keeps one graph node per key scan
+  size_t submap_size_;
+  std::vector<std::shared_ptr<Submap>> submaps_;
+  std::shared_ptr<ScanStore> store_;
+  ThreadPool *pool_;
+  // published state and the handles it shares with the next snapshot
+  uint64_t version_;
+  uint64_t map_version_;
+  std::shared_ptr<const SlamSnapshot> snapshot_;
+  LaserScanHandles scan_handles_;
+  SubmapHandles submap_handles_;
 #ifdef USE_ISAM
   GraphSlam graph_slam_;
 #endif
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_SCAN_STORE_H_
+#define PGSLAM_SCAN_STORE_H_
+
+#include <pgslam/pgslam.h>
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace pgslam {
+
+// on disk store of key scan points. points are appended to one file per
+// square map tile, picked by the scan position when it is inserted, and
+// read back through a memory mapping of that file. at most max_tiles
+// tiles keep their scans in memory; the least recently used one is
+// unmapped and its scans released when another tile is needed
+class ScanStore {
+ public:
+  ScanStore(const std::string &directory, double tile_size,
+      size_t max_tiles);
+  ~ScanStore();
+  ScanStore(const ScanStore &) = delete;
+  ScanStore & operator =(const ScanStore &) = delete;
+  bool ok() const;
+  size_t resident_tiles() const;
+  // write the points of a new key scan to the tile under its position
+  void Insert(size_t scan_id, std::vector<LaserScan> *scans);
+  // page a key scan back in if it was released
+  void Touch(size_t scan_id, std::vector<LaserScan> *scans);
+  // read the points of a key scan without paging it in, from any thread
+  bool Load(size_t scan_id, Eigen::Matrix2Xd *points) const;
+
+ private:
+  struct Tile {
+    std::string path;
+    int fd;
+    void *data;
+    size_t mapped;  // bytes
+    size_t size;    // bytes
+    std::vector<size_t> scans;
+  };
+
+  struct Location {
+    size_t tile;
+    size_t offset;  // doubles
+    size_t count;   // points
+  };
+
+  size_t TileAt(Pose2D pose);
+  bool Map(Tile *tile);
+  void Unmap(Tile *tile);
+  void Use(size_t tile, std::vector<LaserScan> *scans);
+
+ private:
+  std::string directory_;
+  double tile_size_;
+  size_t max_tiles_;
+  bool ok_;
+  std::vector<Tile> tiles_;
+  std::map<std::pair<int, int>, size_t> tile_index_;
+  std::vector<Location> locations_;
+  // tiles whose scans are in memory, most recently used first
+  std::list<size_t> lru_;
+  // Load may run beside the slam thread
+  mutable std::mutex mutex_;
+};
+
+}  // namespace pgslam
+
+#endif  // PGSLAM_SCAN_STORE_H_
@@ -0,0 +1,188 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_SLAM_NODE_H_
+#define PGSLAM_SLAM_NODE_H_
+
+#include <ros/ros.h>
+#include <sensor_msgs/LaserScan.h>
+#include <nav_msgs/OccupancyGrid.h>
+#include <tf/transform_listener.h>
+#include <tf/transform_broadcaster.h>
+#include <geometry_msgs/Point.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <visualization_msgs/Marker.h>
+#include <std_srvs/Trigger.h>
+#include <dynamic_reconfigure/server.h>
+
+#include <pgslam/pgslam.h>
+#include <pgslam/grid_map.h>
+#include <pgslam/thread_pool.h>
+#include <pgslam/PGSlamConfig.h>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pgslam {
+
+// one slam instance with its topics, services and parameters. scans are
+// processed on one strand of a shared pool and maps rendered from
+// snapshots on another, so instances in one process only cost threads
+// while they have work. parameters in cfg/PGSlam.cfg can be changed by
+// dynamic reconfigure while it runs
+class SlamNode {
+ public:
+  // robot is the namespace of the topics and the parameter group under
+  // the private namespace that overrides the shared parameters, empty
+  // for a single robot
+  SlamNode(const std::string &robot, ThreadPool *pool,
+      tf::TransformListener *listener);
+  SlamNode(const SlamNode &) = delete;
+  SlamNode & operator =(const SlamNode &) = delete;
+
+ private:
+  // what can be reconfigured, replaced as a whole and read by the
+  // strands through config()
+  struct Config {
+    SlamConfig slam;
+    double resolution;
+    double draw_range;
+    double full_map_interval;  // full maps in between deltas
+    double graph_tolerance;
+    std::string map_file;
+    std::string map_format;
+  };
+
+  // one published grid and its update topic
+  struct MapOutput {
+    ros::Publisher map_pub;
+    ros::Publisher update_pub;
+    nav_msgs::OccupancyGrid map;  // as last published
+    ros::Time last_full_map;
+  };
+
+  template <typename T>
+  void Param(const std::string &name, T *value) const;
+  void LoadParams();
+  void Configure();
+  void Advertise();
+  std::shared_ptr<const Config> config() const;
+  void Reconfigure(PGSlamConfig &params, uint32_t level);
+
+  // lidar indexes scan_topics_
+  void ScanCallback(const sensor_msgs::LaserScanConstPtr &msg,
+      size_t lidar);
+  // the oldest queued scan once tf has its odometry, one per task
+  void ProcessScans();
+  // the scan of the first lidar with those of the others fused in
+  void ProcessScan(const std::vector<sensor_msgs::LaserScanConstPtr> &msgs,
+      Pose2D odom_new);
+  // where a lidar frame is on the robot, false if tf does not know yet
+  bool LidarMount(const std::string &frame, Pose2D *mount);
+  // false if tf has no transform at stamp yet, zero for the latest one.
+  // never waits, it runs on the shared pool
+  bool ListenPose2D(const std::string &target_frame,
+      const std::string &source_frame, ros::Time stamp, Pose2D *pose);
+  void BroadcastPose(Pose2D pose);
+  // the latest odometry with the last correction, never waits on tf
+  void PublishPose(const ros::TimerEvent &event);
+  void SendCorrection(Pose2D correction, ros::Time stamp);
+
+  // rendering is coalesced, requests made while one is queued join it
+  void RequestRender(bool map, bool graph);
+  void Render();
+  void DrawGraph(const SlamSnapshot &snapshot, const Config &config);
+  void DrawMap(const SlamSnapshot &snapshot, const Config &config);
+  void PublishChunks(const std::vector<geometry_msgs::Point> &points,
+      visualization_msgs::Marker marker, const ros::Publisher &pub,
+      double tolerance, std::vector<geometry_msgs::Point> *published) const;
+  void PublishMap(const GridMap &map, double full_map_interval,
+      MapOutput *output) const;
+  void RenderMap(const SlamSnapshot &snapshot, GridMap *map,
+      double draw_range);
+  bool SaveMap(std_srvs::Trigger::Request &req,
+      std_srvs::Trigger::Response &res);
+
+ private:
+  std::string robot_;
+  ros::NodeHandle node_;
+  tf::TransformListener *listener_;
+  tf::TransformBroadcaster broadcaster_;
+  Slam slam_;
+  Strand slam_strand_;
+  Strand render_strand_;
+
+  std::vector<ros::Subscriber> scan_subs_;
+  ros::Publisher node_pub_;
+  ros::Publisher factor_pub_;
+  ros::Publisher landmark_pub_;
+  ros::Publisher pose_pub_;
+  ros::ServiceServer save_map_srv_;
+  ros::Timer graph_timer_;
+  ros::Timer pose_timer_;
+  std::unique_ptr<dynamic_reconfigure::Server<PGSlamConfig>> reconfigure_;
+  // slam strand only
+  Pose2D odom_old_;
+  std::shared_ptr<const Config> slam_config_;  // as set on slam_
+  ros::Time scan_stamp_;  // of the scan being processed
+  std::map<std::string, Pose2D> mounts_;  // lidar frames, static
+
+  // latest scan of every lidar but the first, not fused yet, and the
+  // fused scans waiting for the slam strand
+  std::mutex scans_mutex_;
+  std::vector<sensor_msgs::LaserScanConstPtr> latest_scans_;
+  std::deque<std::vector<sensor_msgs::LaserScanConstPtr>> queued_scans_;
+  bool scans_posted_;  // a ProcessScans is on the strand
+
+  // map to odom as of the last scan, shared with the pose timer
+  std::mutex correction_mutex_;
+  Pose2D correction_;
+  ros::Time correction_stamp_;  // of the scan it was made at
+  ros::Time correction_sent_;   // latest stamp it was broadcast at
+
+  // render strand only
+  std::vector<GridMap> tiles_;  // pre-rendered tiles of finished submaps
+  double tile_resolution_;
+  double tile_draw_range_;
+  // the finest map first, then one per pyramid level
+  std::vector<MapOutput> map_outputs_;
+  std::vector<GridMap> pyramid_;
+  // graph geometry as it was last published
+  std::vector<geometry_msgs::Point> published_nodes_;
+  std::vector<geometry_msgs::Point> published_factors_;
+  std::vector<geometry_msgs::Point> published_landmarks_;
+
+  std::mutex render_mutex_;
+  bool render_queued_;
+  bool map_dirty_;
+  bool graph_dirty_;
+
+  // swapped atomically
+  std::shared_ptr<const Config> config_;
+
+  // parameters read once, the others are in params_ as last set
+  PGSlamConfig params_;
+  std::string map_frame_;
+  std::string odom_frame_;
+  std::string base_frame_;
+  // lidars fused into one scan per scan of the first, empty for the one
+  // lidar of the scan topic at the origin of the base frame
+  std::vector<std::string> scan_topics_;
+  double fusion_window_;  // seconds between the first lidar and the others
+  double pose_rate_;  // pose and map to odom per second, 0 per scan only
+  std::vector<int> pyramid_factors_;
+  double graph_rate_;  // graph redraws per second, per key scan if <= 0
+  int submap_size_;
+  int graph_cluster_size_;
+  std::string scan_store_directory_;
+  double scan_store_tile_size_;
+  int scan_store_max_tiles_;
+};
+
+}  // namespace pgslam
+
+#endif  // PGSLAM_SLAM_NODE_H_
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_SUBMAP_H_
+#define PGSLAM_SUBMAP_H_
+
+#include <pgslam/pgslam.h>
+#include <Eigen/Eigen>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace pgslam {
+
+// consecutive key scans held rigidly in the frame of the first one
+class Submap {
+ public:
+  explicit Submap(Pose2D pose);
+  Pose2D pose() const;
+  void set_pose(Pose2D pose);
+  // key scan id with its pose in the submap frame
+  const std::vector<std::pair<size_t, Pose2D>> & scans() const;
+  size_t size() const;
+  void Insert(size_t scan_id, const LaserScan &scan, Pose2D local_pose);
+  // no more insertions, the grid is built for the last time and the
+  // points it was built from are dropped
+  void Finish();
+  bool finished() const;
+  const Eigen::Matrix2Xd & points() const;
+  // bounding box of every point inserted so far, in the submap frame
+  Eigen::Vector2d min_point() const;
+  Eigen::Vector2d max_point() const;
+  // match a scan whose pose is given in the submap frame
+  MatchResult Match(const LaserScan &scan, Pose2D local_pose,
+      const MatchBudget &budget) const;
+
+ private:
+  const NDTGrid & grid() const;
+
+ private:
+  Pose2D pose_;
+  std::vector<std::pair<size_t, Pose2D>> scans_;
+  Eigen::Matrix2Xd points_;
+  Eigen::Vector2d min_point_;
+  Eigen::Vector2d max_point_;
+  bool finished_;
+  mutable std::shared_ptr<const NDTGrid> grid_;
+};
+
+}  // namespace pgslam
+
+#endif  // PGSLAM_SUBMAP_H_
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#ifndef PGSLAM_THREAD_POOL_H_
+#define PGSLAM_THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pgslam {
+
+// fixed set of workers, each with its own task deque. a worker runs its
+// newest task first and, when its deque is empty, steals the oldest task
+// of another worker. tasks submitted from a worker go to its own deque,
+// the others are dealt round robin
+class ThreadPool {
+ public:
+  // as many workers as hardware threads if threads is 0
+  explicit ThreadPool(size_t threads);
+  // runs every queued task before joining
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool & operator =(const ThreadPool &) = delete;
+  size_t size() const;
+  void Submit(std::function<void()> task);
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> Async(F f);
+  // block until no task is queued or running
+  void Wait();
+  // body(0) to body(count - 1) on the pool and the calling thread, back
+  // when all are done. the caller works through them too and waits on
+  // none of the tasks, so a worker may call it without a deadlock
+  void ParallelFor(size_t count, std::function<void(size_t)> body);
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  bool Take(size_t index, std::function<void()> *task);
+  void Run(size_t index);
+
+ private:
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  // guards the counters below, which workers sleep on
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+  size_t queued_;
+  size_t running_;
+  size_t next_;
+  bool stop_;
+};
+
+// runs its tasks one at a time and in order on a pool, without holding a
+// worker between them. a serial queue of work that shares the pool with
+// other strands
+class Strand {
+ public:
+  explicit Strand(ThreadPool *pool);
+  Strand(const Strand &) = delete;
+  Strand & operator =(const Strand &) = delete;
+  void Post(std::function<void()> task);
+  // tasks posted but not finished
+  size_t pending() const;
+
+ private:
+  void RunOne();
+
+ private:
+  ThreadPool *pool_;
+  mutable std::mutex mutex_;
+  std::deque<std::function<void()>> tasks_;
+  bool scheduled_;
+};
+
+template <typename F>
+std::future<typename std::result_of<F()>::type> ThreadPool::Async(F f) {
+  typedef typename std::result_of<F()>::type Result;
+  auto task = std::make_shared<std::packaged_task<Result()>>(f);
+  std::future<Result> result = task->get_future();
+  Submit([task]() { (*task)(); });
+  return result;
+}
+
+}  // namespace pgslam
+
+#endif  // PGSLAM_THREAD_POOL_H_
@@ -0,0 +1,543 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/LaserScan.h>
+#include <nav_msgs/Odometry.h>
+#include <tf2_msgs/TFMessage.h>
+
+#include <pgslam/pgslam.h>
+#include <pgslam/config.h>
+#include <pgslam/evaluation.h>
+#include <pgslam/grid_map.h>
+#include <pgslam/lidar_simulator.h>
+#include <pgslam/thread_pool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// runs slam over a simulated or recorded dataset once per variant of its
+// options and reports accuracy, map quality and time side by side as json
+//
+//   pgslam_bench --dataset=sim --laps=1 --variant=icp:matcher=icp
+//     --variant=ndt:matcher=ndt,submap_size=5
+//
+// a bag needs scans and the odometry tf, and gives accuracy only with a
+// nav_msgs/Odometry truth topic, e.g. ground_truth of pgslam_simulator
+
+// truth further apart than this is not interpolated
+const int64_t kMaxTruthGap = 200000000;  // 0.2 s
+
+struct Frame {
+  int64_t time_stamp;
+  std::vector<pgslam::Echo> echos;
+  pgslam::Pose2D odometry;
+};
+
+class Dataset {
+ public:
+  virtual ~Dataset() {}
+  virtual bool Next(Frame *frame) = 0;
+  // poses of the robot over the whole dataset, empty without truth
+  virtual const pgslam::StampedPoses & truth() const = 0;
+  // known world and where the lidar hit it so far, if simulated
+  virtual const pgslam::World * world() const { return NULL; }
+  virtual const std::vector<Eigen::Vector2d> & seen() const {
+    return seen_;
+  }
+
+ protected:
+  std::vector<Eigen::Vector2d> seen_;
+};
+
+class SimulatedDataset : public Dataset {
+ public:
+  SimulatedDataset(const pgslam::World &world,
+      const pgslam::SimulatorConfig &config, size_t scans)
+    : world_(world), simulator_(world_, config), scans_(scans), count_(0) {}
+  bool Next(Frame *frame) {
+    if (count_++ >= scans_) return false;
+    pgslam::SimulatedScan scan = simulator_.Next();
+    frame->time_stamp = scan.time_stamp;
+    frame->echos = scan.echos;
+    frame->odometry = scan.odometry;
+    truth_.push_back(std::make_pair(scan.time_stamp, scan.truth));
+
+    // the ends of the beams, each from where it was fired
+    for (size_t i = 0; i < scan.echos.size(); i++) {
+      const pgslam::Echo &echo = scan.echos[i];
+      if (!std::isfinite(echo.range())) continue;
+      pgslam::Pose2D pose =
+        simulator_.trajectory().At(echo.time_stamp() * 1e-9);
+      double angle = pose.theta() + echo.angle();
+      seen_.push_back(pose.pos() +
+          echo.range() * Eigen::Vector2d(cos(angle), sin(angle)));
+    }
+    return true;
+  }
+  const pgslam::StampedPoses & truth() const { return truth_; }
+  const pgslam::World * world() const { return &world_; }
+
+ private:
+  pgslam::World world_;
+  pgslam::LidarSimulator simulator_;
+  size_t scans_;
+  size_t count_;
+  pgslam::StampedPoses truth_;
+};
+
+std::string StripSlash(const std::string &frame) {
+  return !frame.empty() && frame[0] == '/' ? frame.substr(1) : frame;
+}
+
+pgslam::Pose2D ToPose2D(double x, double y, double z, double w) {
+  return pgslam::Pose2D(x, y, 2 * atan2(z, w));
+}
+
+// scans with the latest odom to base tf at each, read in one pass
+class BagDataset : public Dataset {
+ public:
+  BagDataset(const std::string &path, const std::string &scan_topic,
+      const std::string &truth_topic, const std::string &odom_frame,
+      const std::string &base_frame) {
+    index_ = 0;
+    rosbag::Bag bag;
+    bag.open(path, rosbag::bagmode::Read);
+    std::vector<std::string> topics;
+    topics.push_back(scan_topic);
+    topics.push_back("/tf");
+    if (!truth_topic.empty()) topics.push_back(truth_topic);
+    rosbag::View view(bag, rosbag::TopicQuery(topics));
+    pgslam::Pose2D odometry;
+    for (auto it = view.begin(); it != view.end(); ++it) {
+      const rosbag::MessageInstance &m = *it;
+      if (m.getTopic() == "/tf") {
+        auto tf = m.instantiate<tf2_msgs::TFMessage>();
+        if (!tf) continue;
+        for (auto &t : tf->transforms) {
+          if (StripSlash(t.header.frame_id) != StripSlash(odom_frame) ||
+              StripSlash(t.child_frame_id) != StripSlash(base_frame))
+            continue;
+          odometry = ToPose2D(t.transform.translation.x,
+              t.transform.translation.y, t.transform.rotation.z,
+              t.transform.rotation.w);
+        }
+      } else if (m.getTopic() == truth_topic) {
+        auto odom = m.instantiate<nav_msgs::Odometry>();
+        if (!odom) continue;
+        const geometry_msgs::Pose &pose = odom->pose.pose;
+        truth_.push_back(std::make_pair(odom->header.stamp.toNSec(),
+              ToPose2D(pose.position.x, pose.position.y,
+                pose.orientation.z, pose.orientation.w)));
+      } else {
+        auto msg = m.instantiate<sensor_msgs::LaserScan>();
+        if (!msg) continue;
+        Frame frame;
+        int64_t stamp = msg->header.stamp.toNSec();
+        frame.time_stamp = stamp;
+        frame.odometry = odometry;
+        size_t i = 0;
+        for (double angle = msg->angle_min; angle <= msg->angle_max &&
+            i < msg->ranges.size(); angle += msg->angle_increment, i++) {
+          int64_t time_stamp = stamp +
+            static_cast<int64_t>(i * msg->time_increment * 1e9);
+          double intensity = i < msg->intensities.size() ?
+            msg->intensities[i] : 0.0;
+          frame.echos.push_back(pgslam::Echo(msg->ranges[i], angle,
+                intensity, time_stamp));
+        }
+        frames_.push_back(frame);
+      }
+    }
+    bag.close();
+    std::sort(truth_.begin(), truth_.end(),
+        [](const std::pair<int64_t, pgslam::Pose2D> &a,
+          const std::pair<int64_t, pgslam::Pose2D> &b) {
+          return a.first < b.first;
+        });
+  }
+  bool Next(Frame *frame) {
+    if (index_ >= frames_.size()) return false;
+    *frame = frames_[index_++];
+    return true;
+  }
+  const pgslam::StampedPoses & truth() const { return truth_; }
+
+ private:
+  std::vector<Frame> frames_;
+  size_t index_;
+  pgslam::StampedPoses truth_;
+};
+
+// set one slam option by its node parameter name, false if unknown
+bool ApplyOption(const std::string &key, const std::string &value,
+    pgslam::Slam *slam, pgslam::SlamConfig *config,
+    std::unique_ptr<pgslam::ThreadPool> *pool) {
+  // the structure of the map is set once, not through the config
+  if (key == "threads") {
+    // workers icp of large scans spreads over, none without the option
+    pool->reset(new pgslam::ThreadPool(atoi(value.c_str())));
+    slam->set_thread_pool(pool->get());
+  } else if (key == "submap_size") {
+    slam->set_submap_size(atoi(value.c_str()));
+  } else if (key == "graph_cluster_size") {
+    slam->set_graph_cluster_size(atoi(value.c_str()));
+  } else {
+    return pgslam::SetOption(key, value, config);
+  }
+  return true;
+}
+
+struct Variant {
+  std::string name;
+  std::vector<std::pair<std::string, std::string>> options;
+};
+
+// name:key=value,key=value
+bool ParseVariant(const std::string &text, Variant *variant) {
+  size_t colon = text.find(':');
+  variant->name = text.substr(0, colon);
+  if (colon == std::string::npos) return true;
+  std::istringstream in(text.substr(colon + 1));
+  std::string option;
+  while (std::getline(in, option, ',')) {
+    size_t equal = option.find('=');
+    if (equal == std::string::npos) return false;
+    variant->options.push_back(std::make_pair(option.substr(0, equal),
+          option.substr(equal + 1)));
+  }
+  return true;
+}
+
+// a map of the key scans as they end up, drawn scan by scan
+pgslam::GridMap RenderKeyScans(const pgslam::SlamSnapshot &snapshot,
+    double resolution, double draw_range) {
+  const pgslam::LaserScanHandles &scans = *snapshot.scans;
+  Eigen::Vector2d min(0.0, 0.0);
+  Eigen::Vector2d max(0.0, 0.0);
+  for (size_t i = 0; i < scans.size(); i++) {
+    pgslam::LaserScan scan = *scans[i];
+    min = min.cwiseMin(Eigen::Vector2d(scan.min_x_in_world(),
+          scan.min_y_in_world()));
+    max = max.cwiseMax(Eigen::Vector2d(scan.max_x_in_world(),
+          scan.max_y_in_world()));
+  }
+  min -= Eigen::Vector2d(1.0, 1.0);
+  max += Eigen::Vector2d(1.0, 1.0);
+  pgslam::GridMap map(resolution, min, (max.x() - min.x()) / resolution,
+      (max.y() - min.y()) / resolution);
+  for (size_t i = 0; i < scans.size(); i++) {
+    pgslam::LaserScan scan = snapshot.scan(i);
+    map.DrawScan(scan, scan.pose(), draw_range);
+  }
+  return map;
+}
+
+std::string Json(const pgslam::AbsoluteError &error) {
+  std::ostringstream out;
+  out << std::setprecision(6) << "{\"poses\":" << error.poses
+    << ",\"rmse\":" << error.rmse << ",\"mean\":" << error.mean
+    << ",\"max\":" << error.max << "}";
+  return out.str();
+}
+
+std::string Json(const pgslam::RelativeError &error) {
+  std::ostringstream out;
+  out << std::setprecision(6) << "{\"pairs\":" << error.pairs
+    << ",\"delta\":" << error.delta
+    << ",\"translation_rmse\":" << error.translation_rmse
+    << ",\"rotation_rmse\":" << error.rotation_rmse << "}";
+  return out.str();
+}
+
+std::string Json(const pgslam::MapQuality &quality) {
+  std::ostringstream out;
+  out << std::setprecision(6) << "{\"occupied\":" << quality.occupied
+    << ",\"ambiguous_ratio\":" << quality.ambiguous_ratio;
+  if (quality.has_truth) {
+    out << ",\"precision\":" << quality.precision
+      << ",\"recall\":" << quality.recall;
+  }
+  out << "}";
+  return out.str();
+}
+
+struct Settings {
+  double resolution;
+  double draw_range;
+  double rpe_delta;
+  double tolerance;
+};
+
+// one run of slam over the whole dataset, as a json object
+std::string Run(const Variant &variant, Dataset *dataset,
+    const Settings &settings, std::ostream *summary) {
+  // outlives the slam
+  std::unique_ptr<pgslam::ThreadPool> pool;
+  pgslam::Slam slam;
+  pgslam::SlamConfig config = slam.config();
+  for (auto &option : variant.options) {
+    if (!ApplyOption(option.first, option.second, &slam, &config, &pool))
+      std::cerr << "Error: unknown option " << option.first << "="
+        << option.second << std::endl;
+  }
+  slam.set_config(config);
+
+  Frame frame;
+  pgslam::Pose2D odom_old;
+  pgslam::StampedPoses online;
+  std::vector<double> times;
+  while (dataset->Next(&frame)) {
+    auto begin = std::chrono::steady_clock::now();
+    slam.UpdatePoseWithPose(frame.odometry * odom_old.inverse());
+    odom_old = frame.odometry;
+    slam.UpdatePoseWithLaserScan(pgslam::LaserScan(frame.echos));
+    times.push_back(std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - begin).count());
+    online.push_back(std::make_pair(frame.time_stamp, slam.pose()));
+  }
+  auto snapshot = slam.snapshot();
+
+  std::ostringstream out;
+  out << std::setprecision(6);
+  out << "{\"variant\":\"" << variant.name << "\",\"options\":{";
+  for (size_t i = 0; i < variant.options.size(); i++) {
+    out << (i ? "," : "") << "\"" << variant.options[i].first << "\":\""
+      << variant.options[i].second << "\"";
+  }
+  out << "},\"scans\":" << times.size()
+    << ",\"keyscans\":" << snapshot->scans->size();
+
+  double total = 0.0;
+  for (size_t i = 0; i < times.size(); i++) total += times[i];
+  std::vector<double> sorted = times;
+  std::sort(sorted.begin(), sorted.end());
+  auto percentile = [&sorted](double p) {
+    return sorted.empty() ? 0.0 :
+      sorted[std::min(sorted.size() - 1,
+          static_cast<size_t>(p * sorted.size()))];
+  };
+  out << ",\"time\":{\"total\":" << total
+    << ",\"mean\":" << (times.empty() ? 0.0 : total / times.size())
+    << ",\"p50\":" << percentile(0.5) << ",\"p95\":" << percentile(0.95)
+    << ",\"max\":" << (sorted.empty() ? 0.0 : sorted.back())
+    << ",\"scans_per_second\":" << (total > 0 ? times.size() / total : 0.0)
+    << "}";
+
+  // the online poses as tracked, and the key scans after the last
+  // optimization, both against the truth at their time stamps
+  const pgslam::StampedPoses &truth = dataset->truth();
+  std::vector<pgslam::Pose2D> estimate;
+  std::vector<pgslam::Pose2D> reference;
+  for (size_t i = 0; i < online.size(); i++) {
+    pgslam::Pose2D pose;
+    if (!pgslam::InterpolatePose(truth, online[i].first, kMaxTruthGap,
+          &pose)) continue;
+    estimate.push_back(online[i].second);
+    reference.push_back(pose);
+  }
+  pgslam::AbsoluteError ate = pgslam::EvaluateAbsolute(estimate, reference);
+  pgslam::RelativeError rpe =
+    pgslam::EvaluateRelative(estimate, reference, settings.rpe_delta);
+  std::vector<pgslam::Pose2D> keyscans;
+  std::vector<pgslam::Pose2D> keyscan_reference;
+  for (size_t i = 0; i < snapshot->scans->size(); i++) {
+    const pgslam::LaserScan &scan = *(*snapshot->scans)[i];
+    pgslam::Pose2D pose;
+    if (!pgslam::InterpolatePose(truth, scan.time_stamp(), kMaxTruthGap,
+          &pose)) continue;
+    keyscans.push_back(scan.pose());
+    keyscan_reference.push_back(pose);
+  }
+  pgslam::AbsoluteError keyscan_ate =
+    pgslam::EvaluateAbsolute(keyscans, keyscan_reference);
+  if (ate.poses > 0) {
+    out << ",\"ate\":{\"online\":" << Json(ate)
+      << ",\"keyscans\":" << Json(keyscan_ate) << "}"
+      << ",\"rpe\":" << Json(rpe);
+  } else {
+    out << ",\"ate\":null,\"rpe\":null";
+  }
+
+  // the map goes into the world with the key scan alignment
+  pgslam::GridMap map = RenderKeyScans(*snapshot, settings.resolution,
+      settings.draw_range);
+  pgslam::MapQuality quality = pgslam::EvaluateMap(map,
+      keyscan_ate.poses > 0 ? dataset->world() : NULL, dataset->seen(),
+      keyscan_ate.alignment, settings.tolerance);
+  out << ",\"map\":" << Json(quality) << "}";
+
+  *summary << std::left << std::setw(16) << variant.name << std::right
+    << std::fixed << std::setprecision(4)
+    << std::setw(10) << (ate.poses ? ate.rmse : NAN)
+    << std::setw(10) << (keyscan_ate.poses ? keyscan_ate.rmse : NAN)
+    << std::setw(10) << (rpe.pairs ? rpe.translation_rmse : NAN)
+    << std::setw(10) << (quality.has_truth ? quality.precision : NAN)
+    << std::setw(10) << (quality.has_truth ? quality.recall : NAN)
+    << std::setw(10) << quality.ambiguous_ratio
+    << std::setw(10) << std::setprecision(1)
+    << (total > 0 ? times.size() / total : 0.0) << std::endl;
+  return out.str();
+}
+
+int main(int argc, char **argv) {
+  // the report goes to stdout, keep slam progress out of it. ros logs
+  // below warnings are dropped, and what the slam prints to std::cout
+  // goes to stderr with the table
+  if (ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME,
+        ros::console::levels::Warn))
+    ros::console::notifyLoggerLevelsChanged();
+  std::ostream stdout_stream(std::cout.rdbuf());
+  std::cout.rdbuf(std::cerr.rdbuf());
+
+  std::map<std::string, std::string> args;
+  std::vector<Variant> variants;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t equal = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || equal == std::string::npos) {
+      std::cerr << "Error: expected --key=value, got " << arg << std::endl;
+      return 1;
+    }
+    std::string key = arg.substr(2, equal - 2);
+    std::string value = arg.substr(equal + 1);
+    if (key == "variant") {
+      Variant variant;
+      if (!ParseVariant(value, &variant)) {
+        std::cerr << "Error: bad variant " << value << std::endl;
+        return 1;
+      }
+      variants.push_back(variant);
+    } else {
+      args[key] = value;
+    }
+  }
+  if (variants.empty()) {
+    Variant variant;
+    variant.name = "default";
+    variants.push_back(variant);
+  }
+  auto arg = [&args](const std::string &key, const std::string &value) {
+    auto found = args.find(key);
+    return found == args.end() ? value : found->second;
+  };
+  auto number = [&arg](const std::string &key, double value) {
+    return atof(arg(key, std::to_string(value)).c_str());
+  };
+
+  Settings settings;
+  settings.resolution = number("resolution", 0.05);
+  settings.draw_range = number("draw_range", 6.0);
+  settings.rpe_delta = number("rpe_delta", 1.0);
+  settings.tolerance = number("tolerance", 0.1);
+
+  // a fresh dataset per variant, the simulated one repeats from its seed
+  std::function<std::unique_ptr<Dataset>()> open;
+  std::string dataset = arg("dataset", "sim");
+  std::ostringstream description;
+  if (dataset == "sim") {
+    pgslam::SimulatorConfig config;
+    config.beams = number("beams", config.beams);
+    config.rate = number("rate", config.rate);
+    config.range_max = number("range_max", config.range_max);
+    config.range_noise = number("range_noise", config.range_noise);
+    config.dropout = number("dropout", config.dropout);
+    config.odometry_noise = number("odometry_noise", config.odometry_noise);
+    config.heading_noise = number("heading_noise", config.heading_noise);
+    config.speed = number("speed", config.speed);
+    config.turn_rate = number("turn_rate", config.turn_rate);
+    config.seed = number("seed", config.seed);
+    pgslam::World world;
+    std::string world_file = arg("world", "");
+    if (world_file.empty()) {
+      world = pgslam::World::Generate(number("rooms_x", 3),
+          number("rooms_y", 2), number("room_size", 6.0),
+          number("world_resolution", 0.05), config.seed);
+    } else if (!pgslam::World::Load(world_file, &world)) {
+      return 1;
+    }
+    std::istringstream waypoints(arg("waypoints", ""));
+    std::vector<double> values;
+    std::string value;
+    while (std::getline(waypoints, value, ','))
+      values.push_back(atof(value.c_str()));
+    if (values.size() >= 2) {
+      std::vector<Eigen::Vector2d> points;
+      for (size_t i = 0; i + 1 < values.size(); i += 2)
+        points.push_back(Eigen::Vector2d(values[i], values[i + 1]));
+      world.set_waypoints(points);
+    }
+    pgslam::Trajectory trajectory(world.waypoints(), config.speed,
+        config.turn_rate);
+    size_t scans = ceil(number("laps", 1.0) *
+        std::max(trajectory.period(), 1.0) * config.rate);
+    description << "{\"type\":\"sim\",\"beams\":" << config.beams
+      << ",\"rate\":" << config.rate << ",\"seed\":" << config.seed
+      << ",\"scans\":" << scans << "}";
+    open = [world, config, scans]() {
+      return std::unique_ptr<Dataset>(
+          new SimulatedDataset(world, config, scans));
+    };
+  } else if (dataset == "bag") {
+    std::string bag = arg("bag", "");
+    std::string scan_topic = arg("scan_topic", "/scan");
+    std::string truth_topic = arg("truth_topic", "");
+    std::string odom_frame = arg("odom_frame", "odom");
+    std::string base_frame = arg("base_frame", "base_link");
+    description << "{\"type\":\"bag\",\"bag\":\"" << bag << "\"}";
+    open = [=]() {
+      return std::unique_ptr<Dataset>(new BagDataset(bag, scan_topic,
+            truth_topic, odom_frame, base_frame));
+    };
+  } else {
+    std::cerr << "Error: unknown dataset " << dataset << std::endl;
+    return 1;
+  }
+
+  std::cerr << std::left << std::setw(16) << "variant" << std::right
+    << std::setw(10) << "ate" << std::setw(10) << "ate_key"
+    << std::setw(10) << "rpe" << std::setw(10) << "precision"
+    << std::setw(10) << "recall" << std::setw(10) << "ambiguous"
+    << std::setw(10) << "scans/s" << std::endl;
+  std::ostringstream report;
+  report << "{\"dataset\":" << description.str() << ",\"results\":[";
+  for (size_t i = 0; i < variants.size(); i++) {
+    std::unique_ptr<Dataset> data;
+    try {
+      data = open();
+    } catch (const rosbag::BagException &e) {
+      std::cerr << "Error: cannot read bag: " << e.what() << std::endl;
+      return 1;
+    }
+    report << (i ? "," : "") << Run(variants[i], data.get(), settings,
+        &std::cerr);
+  }
+  report << "]}";
+
+  std::string output = arg("output", "");
+  if (output.empty()) {
+    stdout_stream << report.str() << std::endl;
+  } else {
+    std::ofstream file(output.c_str());
+    file << report.str() << std::endl;
+    if (!file.good()) {
+      std::cerr << "Error: cannot write " << output << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
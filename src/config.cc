@@ -0,0 +1,183 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/config.h>
+
+#include <sstream>
+
+namespace pgslam {
+
+namespace {
+
+template <typename T>
+bool ParseNumber(const std::string &text, T *value) {
+  std::istringstream in(text);
+  T number;
+  if (!(in >> number) || !(in >> std::ws).eof()) return false;
+  *value = number;
+  return true;
+}
+
+}  // namespace
+
+bool ParseKeyScanPolicy(const std::string &name, KeyScanPolicy *policy) {
+  if (name == "distance") {
+    *policy = KeyScanPolicy::kDistance;
+  } else if (name == "overlap") {
+    *policy = KeyScanPolicy::kOverlap;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseAssociation(const std::string &name, Association *association) {
+  if (name == "auto") {
+    *association = Association::kAuto;
+  } else if (name == "projective") {
+    *association = Association::kProjective;
+  } else if (name == "kdtree") {
+    *association = Association::kKDTree;
+  } else if (name == "grid") {
+    *association = Association::kGrid;
+  } else if (name == "bruteforce") {
+    *association = Association::kBruteForce;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseMatcher(const std::string &name, Matcher *matcher) {
+  if (name == "icp") {
+    *matcher = Matcher::kICP;
+  } else if (name == "gicp") {
+    *matcher = Matcher::kGICP;
+  } else if (name == "ndt") {
+    *matcher = Matcher::kNDT;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParsePrediction(const std::string &name, Prediction *prediction) {
+  if (name == "odometry") {
+    *prediction = Prediction::kOdometry;
+  } else if (name == "constant_velocity") {
+    *prediction = Prediction::kConstantVelocity;
+  } else if (name == "blended") {
+    *prediction = Prediction::kBlended;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParsePrecision(const std::string &name, Precision *precision) {
+  if (name == "double") {
+    *precision = Precision::kDouble;
+  } else if (name == "float") {
+    *precision = Precision::kFloat;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseRejection(const std::string &name, Rejection *rejection) {
+  if (name == "trim") {
+    *rejection = Rejection::kTrim;
+  } else if (name == "robust") {
+    *rejection = Rejection::kRobust;
+  } else if (name == "duplicate") {
+    *rejection = Rejection::kDuplicate;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseSolver(const std::string &name, Solver *solver) {
+  if (name == "heuristic") {
+    *solver = Solver::kHeuristic;
+  } else if (name == "svd") {
+    *solver = Solver::kSVD;
+  } else if (name == "point_to_line") {
+    *solver = Solver::kPointToLine;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool SetOption(const std::string &key, const std::string &value,
+    SlamConfig *config) {
+  if (key == "keyscan_policy")
+    return ParseKeyScanPolicy(value, &config->keyscan_policy);
+  if (key == "association")
+    return ParseAssociation(value, &config->association);
+  if (key == "matcher")
+    return ParseMatcher(value, &config->matcher);
+  if (key == "prediction")
+    return ParsePrediction(value, &config->prediction);
+  if (key == "precision")
+    return ParsePrecision(value, &config->match.precision);
+  if (key == "rejection")
+    return ParseRejection(value, &config->match.rejection);
+  if (key == "solver")
+    return ParseSolver(value, &config->match.solver);
+
+  // same names as the node parameters
+  MatchConfig &match = config->match;
+  if (key == "keyscan_threshold")
+    return ParseNumber(value, &config->keyscan_threshold);
+  if (key == "factor_threshold")
+    return ParseNumber(value, &config->factor_threshold);
+  if (key == "keyscan_overlap")
+    return ParseNumber(value, &config->keyscan_overlap);
+  if (key == "keyscan_hysteresis")
+    return ParseNumber(value, &config->keyscan_hysteresis);
+  if (key == "tracking_time_budget")
+    return ParseNumber(value, &config->tracking_budget.max_time);
+  if (key == "tracking_iterations")
+    return ParseNumber(value, &config->tracking_budget.max_iterations);
+  if (key == "factor_time_budget")
+    return ParseNumber(value, &config->factor_budget.max_time);
+  if (key == "factor_iterations")
+    return ParseNumber(value, &config->factor_budget.max_iterations);
+  if (key == "prediction_blend")
+    return ParseNumber(value, &config->prediction_blend);
+  if (key == "match_threshold")
+    return ParseNumber(value, &match.match_threshold);
+  if (key == "dist_threshold")
+    return ParseNumber(value, &match.dist_threshold);
+  if (key == "interpolation")
+    return ParseNumber(value, &match.interpolation);
+  if (key == "trim_ratio")
+    return ParseNumber(value, &match.trim_ratio);
+  if (key == "max_shared")
+    return ParseNumber(value, &match.max_shared);
+  if (key == "projective_window")
+    return ParseNumber(value, &match.projective_window);
+  if (key == "covariance_radius")
+    return ParseNumber(value, &match.covariance_radius);
+  if (key == "ndt_resolution")
+    return ParseNumber(value, &match.ndt_resolution);
+  if (key == "parallel_points")
+    return ParseNumber(value, &match.parallel_points);
+  LandmarkConfig &landmark = config->landmark;
+  if (key == "landmark_intensity")
+    return ParseNumber(value, &landmark.intensity);
+  if (key == "landmark_min_points")
+    return ParseNumber(value, &landmark.min_points);
+  if (key == "landmark_max_size")
+    return ParseNumber(value, &landmark.max_size);
+  if (key == "landmark_gate")
+    return ParseNumber(value, &landmark.gate);
+  if (key == "landmark_weight")
+    return ParseNumber(value, &landmark.weight);
+  return false;
+}
+
+}  // namespace pgslam
@@ -0,0 +1,220 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/evaluation.h>
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+namespace pgslam {
+
+namespace {
+
+// same thresholds as the exported maps
+const int kFreeThreshold = 25;
+const int kOccupiedThreshold = 65;
+
+// any occupied cell of the map within radius cells of x, y
+bool OccupiedNear(const GridMap &map, int x, int y, int radius) {
+  for (int dy = -radius; dy <= radius; dy++) {
+    for (int dx = -radius; dx <= radius; dx++) {
+      if (map.at(x + dx, y + dy) >= kOccupiedThreshold) return true;
+    }
+  }
+  return false;
+}
+
+bool OccupiedNear(const World &world, int x, int y, int radius) {
+  for (int dy = -radius; dy <= radius; dy++) {
+    for (int dx = -radius; dx <= radius; dx++) {
+      if (world.occupied(x + dx, y + dy)) return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+AbsoluteError::AbsoluteError() {
+  poses = 0;
+  rmse = 0.0;
+  mean = 0.0;
+  max = 0.0;
+}
+
+RelativeError::RelativeError() {
+  pairs = 0;
+  delta = 0.0;
+  translation_rmse = 0.0;
+  rotation_rmse = 0.0;
+}
+
+MapQuality::MapQuality() {
+  occupied = 0;
+  ambiguous_ratio = 0.0;
+  has_truth = false;
+  precision = 0.0;
+  recall = 0.0;
+}
+
+bool InterpolatePose(const StampedPoses &poses, int64_t time_stamp,
+    int64_t max_gap, Pose2D *pose) {
+  auto after = std::lower_bound(poses.begin(), poses.end(), time_stamp,
+      [](const std::pair<int64_t, Pose2D> &p, int64_t t) {
+        return p.first < t;
+      });
+  if (after == poses.end()) return false;
+  if (after->first == time_stamp) {
+    *pose = after->second;
+    return true;
+  }
+  if (after == poses.begin()) return false;
+  auto before = after - 1;
+  if (after->first - before->first > max_gap) return false;
+
+  // the motion between both, scaled down in the frame of the first
+  double ratio = static_cast<double>(time_stamp - before->first) /
+    (after->first - before->first);
+  Pose2D delta = after->second * before->second.inverse();
+  Pose2D part(delta.x() * ratio, delta.y() * ratio, delta.theta() * ratio);
+  *pose = part * before->second;
+  return true;
+}
+
+AbsoluteError EvaluateAbsolute(const std::vector<Pose2D> &estimate,
+    const std::vector<Pose2D> &truth) {
+  AbsoluteError error;
+  size_t n = std::min(estimate.size(), truth.size());
+  if (n == 0) return error;
+
+  // closed form rigid fit of the estimated onto the true positions
+  Eigen::Vector2d mean_estimate(0.0, 0.0);
+  Eigen::Vector2d mean_truth(0.0, 0.0);
+  for (size_t i = 0; i < n; i++) {
+    mean_estimate += estimate[i].pos();
+    mean_truth += truth[i].pos();
+  }
+  mean_estimate /= n;
+  mean_truth /= n;
+  Eigen::Matrix2d cov = Eigen::Matrix2d::Zero();
+  for (size_t i = 0; i < n; i++) {
+    cov += (estimate[i].pos() - mean_estimate) *
+      (truth[i].pos() - mean_truth).transpose();
+  }
+  double angle = atan2(cov(0, 1) - cov(1, 0), cov(0, 0) + cov(1, 1));
+  Eigen::Vector2d shift = mean_truth -
+    Eigen::Rotation2D<double>(angle) * mean_estimate;
+  error.alignment = Pose2D(shift.x(), shift.y(), angle);
+
+  double sum = 0.0;
+  double squares = 0.0;
+  auto transform = error.alignment.ToTransform();
+  for (size_t i = 0; i < n; i++) {
+    double e = (transform * estimate[i].pos() - truth[i].pos()).norm();
+    sum += e;
+    squares += e * e;
+    error.max = std::max(error.max, e);
+  }
+  error.poses = n;
+  error.mean = sum / n;
+  error.rmse = sqrt(squares / n);
+  return error;
+}
+
+RelativeError EvaluateRelative(const std::vector<Pose2D> &estimate,
+    const std::vector<Pose2D> &truth, double delta) {
+  RelativeError error;
+  error.delta = delta;
+  size_t n = std::min(estimate.size(), truth.size());
+  if (n < 2 || delta <= 0.0) return error;
+
+  // distance travelled along the truth up to every pose
+  std::vector<double> travelled(n, 0.0);
+  for (size_t i = 1; i < n; i++) {
+    travelled[i] = travelled[i - 1] +
+      (truth[i].pos() - truth[i - 1].pos()).norm();
+  }
+  double translation = 0.0;
+  double rotation = 0.0;
+  size_t j = 0;
+  for (size_t i = 0; i < n; i++) {
+    j = std::max(j, i + 1);
+    while (j < n && travelled[j] - travelled[i] < delta) j++;
+    if (j >= n) break;
+    Pose2D true_motion = truth[j] * truth[i].inverse();
+    Pose2D motion = estimate[j] * estimate[i].inverse();
+    Pose2D difference = motion * true_motion.inverse();
+    translation += difference.pos().squaredNorm();
+    rotation += difference.theta() * difference.theta();
+    error.pairs++;
+  }
+  if (error.pairs == 0) return error;
+  error.translation_rmse = sqrt(translation / error.pairs);
+  error.rotation_rmse = sqrt(rotation / error.pairs);
+  return error;
+}
+
+MapQuality EvaluateMap(const GridMap &map, const World *world,
+    const std::vector<Eigen::Vector2d> &seen, Pose2D alignment,
+    double tolerance) {
+  MapQuality quality;
+  size_t observed = 0;
+  size_t ambiguous = 0;
+  for (size_t i = 0; i < map.data().size(); i++) {
+    int8_t value = map.data()[i];
+    if (value < 0) continue;
+    observed++;
+    if (value >= kOccupiedThreshold) {
+      quality.occupied++;
+    } else if (value > kFreeThreshold) {
+      ambiguous++;
+    }
+  }
+  if (observed > 0)
+    quality.ambiguous_ratio = static_cast<double>(ambiguous) / observed;
+  if (world == NULL) return quality;
+  quality.has_truth = true;
+
+  // every occupied cell of the map checked against the world
+  auto to_world = alignment.ToTransform();
+  int world_radius = ceil(tolerance / world->resolution());
+  size_t hits = 0;
+  for (int y = 0; y < map.height(); y++) {
+    for (int x = 0; x < map.width(); x++) {
+      if (map.at(x, y) < kOccupiedThreshold) continue;
+      Eigen::Vector2d p = to_world * (map.origin() +
+          map.resolution() * Eigen::Vector2d(x + 0.5, y + 0.5));
+      Eigen::Vector2d cell = (p - world->origin()) / world->resolution();
+      if (OccupiedNear(*world, floor(cell.x()), floor(cell.y()),
+            world_radius))
+        hits++;
+    }
+  }
+  if (quality.occupied > 0)
+    quality.precision = static_cast<double>(hits) / quality.occupied;
+
+  // and every wall cell the lidar saw against the map, once per cell
+  std::set<std::pair<int, int>> walls;
+  for (size_t i = 0; i < seen.size(); i++) {
+    Eigen::Vector2d cell = (seen[i] - world->origin()) / world->resolution();
+    int x = floor(cell.x());
+    int y = floor(cell.y());
+    if (world->occupied(x, y)) walls.insert(std::make_pair(x, y));
+  }
+  auto to_map = alignment.inverse().ToTransform();
+  int map_radius = ceil(tolerance / map.resolution());
+  size_t found = 0;
+  for (auto &wall : walls) {
+    Eigen::Vector2d p = to_map * (world->origin() + world->resolution() *
+        Eigen::Vector2d(wall.first + 0.5, wall.second + 0.5));
+    Eigen::Vector2d cell = (p - map.origin()) / map.resolution();
+    if (OccupiedNear(map, floor(cell.x()), floor(cell.y()), map_radius))
+      found++;
+  }
+  if (!walls.empty())
+    quality.recall = static_cast<double>(found) / walls.size();
+  return quality;
+}
+
+}  // namespace pgslam
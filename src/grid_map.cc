@@ -0,0 +1,161 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/grid_map.h>
+
+#include <float.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace pgslam {
+
+GridMap::GridMap() {
+  resolution_ = 0.05;
+  origin_ = Eigen::Vector2d(0.0, 0.0);
+  width_ = 0;
+  height_ = 0;
+}
+
+GridMap::GridMap(double resolution, Eigen::Vector2d origin,
+    int width, int height) {
+  resolution_ = resolution;
+  origin_ = origin;
+  width_ = width;
+  height_ = height;
+  data_.assign(static_cast<size_t>(width_) * height_, -1);
+}
+
+double GridMap::resolution() const { return resolution_; }
+Eigen::Vector2d GridMap::origin() const { return origin_; }
+int GridMap::width() const { return width_; }
+int GridMap::height() const { return height_; }
+const std::vector<int8_t> & GridMap::data() const { return data_; }
+
+int8_t GridMap::at(int x, int y) const {
+  if (x < 0 || x >= width_ || y < 0 || y >= height_) return -1;
+  return data_[static_cast<size_t>(y) * width_ + x];
+}
+
+void GridMap::MarkFree(int x, int y) {
+  if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
+  int8_t &cell = data_[static_cast<size_t>(y) * width_ + x];
+  if (cell == -1) {
+    cell = 30;  // white
+  } else {
+    cell = static_cast<int>(cell * 0.8);
+  }
+}
+
+void GridMap::MarkOccupied(int x, int y) {
+  if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
+  int8_t &cell = data_[static_cast<size_t>(y) * width_ + x];
+  if (cell == -1) {
+    cell = 100;  // black
+  } else {
+    cell = static_cast<int>(static_cast<int>(cell * 0.2) + 100 * 0.8);
+  }
+}
+
+void GridMap::DrawScan(const Eigen::Vector2d &origin,
+    const Eigen::Matrix2Xd &points, double draw_range) {
+  for (int j = 1; j < points.cols(); j++) {  // for every point
+    Eigen::Vector2d v = points.col(j) - origin;
+    if (!v.allFinite()) continue;
+    if (v.norm() > draw_range)
+      v = v.normalized() * (draw_range + resolution_);
+    int steps = v.norm() / resolution_;
+    Eigen::Vector2d step = v / steps / resolution_;
+    Eigen::Vector2d current = (origin - origin_) / resolution_;
+    for (int i = 0; i < steps; i++) {  // for every step
+      MarkFree(floor(current.x()), floor(current.y()));
+      current += step;
+    }
+    if (v.norm() < draw_range)
+      MarkOccupied(floor(current.x()), floor(current.y()));
+  }
+}
+
+void GridMap::DrawScan(const LaserScan &scan, Pose2D pose,
+    double draw_range) {
+  auto transform = pose.ToTransform();
+  for (auto &lidar : scan.lidars()) {
+    DrawScan((lidar.mount * pose).pos(), transform *
+        scan.local_points().middleCols(lidar.first, lidar.count), draw_range);
+  }
+}
+
+void GridMap::Merge(const GridMap &tile, Pose2D tile_pose) {
+  if (tile.width_ == 0 || tile.height_ == 0) return;
+
+  // bounding box of the tile corners in this map
+  auto to_map = tile_pose.ToTransform();
+  Eigen::Vector2d min(DBL_MAX, DBL_MAX);
+  Eigen::Vector2d max(-DBL_MAX, -DBL_MAX);
+  for (int k = 0; k < 4; k++) {
+    Eigen::Vector2d corner = tile.origin_ + tile.resolution_ *
+      Eigen::Vector2d((k % 2) * tile.width_, (k / 2) * tile.height_);
+    Eigen::Vector2d p = to_map * corner;
+    min = min.cwiseMin(p);
+    max = max.cwiseMax(p);
+  }
+  int x0 = std::max(0, static_cast<int>(floor((min.x() - origin_.x()) /
+          resolution_)));
+  int y0 = std::max(0, static_cast<int>(floor((min.y() - origin_.y()) /
+          resolution_)));
+  int x1 = std::min(width_, static_cast<int>(ceil((max.x() - origin_.x()) /
+          resolution_)) + 1);
+  int y1 = std::min(height_, static_cast<int>(ceil((max.y() - origin_.y()) /
+          resolution_)) + 1);
+
+  // sample the tile at every covered cell, one observation per tile
+  auto to_tile = tile_pose.inverse().ToTransform();
+  for (int y = y0; y < y1; y++) {
+    for (int x = x0; x < x1; x++) {
+      Eigen::Vector2d center = origin_ +
+        resolution_ * Eigen::Vector2d(x + 0.5, y + 0.5);
+      Eigen::Vector2d p = (to_tile * center - tile.origin_) /
+        tile.resolution_;
+      int8_t value = tile.at(floor(p.x()), floor(p.y()));
+      if (value == -1) continue;
+      int8_t &cell = data_[static_cast<size_t>(y) * width_ + x];
+      if (cell == -1) {
+        cell = value;
+      } else if (value >= 50) {
+        cell = static_cast<int>(cell * 0.2 + value * 0.8);
+      } else {
+        cell = static_cast<int>(cell * 0.8);
+      }
+    }
+  }
+}
+
+GridMap GridMap::Downsample(int factor) const {
+  factor = std::max(factor, 1);
+  GridMap coarse(resolution_ * factor, origin_,
+      (width_ + factor - 1) / factor, (height_ + factor - 1) / factor);
+  coarse.Pool(*this, factor, 0, 0, width_ - 1, height_ - 1);
+  return coarse;
+}
+
+void GridMap::Pool(const GridMap &fine, int factor, int min_x, int min_y,
+    int max_x, int max_y) {
+  factor = std::max(factor, 1);
+  int x0 = std::max(0, min_x / factor);
+  int y0 = std::max(0, min_y / factor);
+  int x1 = std::min(width_ - 1, max_x / factor);
+  int y1 = std::min(height_ - 1, max_y / factor);
+  for (int y = y0; y <= y1; y++) {
+    for (int x = x0; x <= x1; x++) {
+      // unknown is -1, so max pooling prefers any observed cell
+      int8_t value = -1;
+      for (int fy = y * factor; fy < (y + 1) * factor; fy++) {
+        for (int fx = x * factor; fx < (x + 1) * factor; fx++)
+          value = std::max(value, fine.at(fx, fy));
+      }
+      data_[static_cast<size_t>(y) * width_ + x] = value;
+    }
+  }
+}
+
+}  // namespace pgslam
@@ -0,0 +1,329 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/hierarchical_graph.h>
+
+#ifdef USE_ISAM
+#include <isam/isam.h>
+
+#include <map>
+#include <memory>
+
+namespace pgslam {
+
+// information of the prior that holds an anchor at the cluster origin
+const double kAnchorInformation = 1e6;
+// information of the prior that keeps a disconnected node in place
+const double kFloatingInformation = 1e-3;
+
+namespace {
+
+isam::Pose2d ToIsam(Pose2D pose) {
+  return isam::Pose2d(pose.x(), pose.y(), pose.theta());
+}
+
+Pose2D FromIsam(const isam::Pose2d &pose) {
+  return Pose2D(pose.x(), pose.y(), pose.t());
+}
+
+// indices reachable from the seeds along the edges, by flood fill
+std::vector<bool> Reachable(size_t size,
+    const std::vector<std::pair<size_t, size_t>> &edges,
+    const std::vector<size_t> &seeds) {
+  std::vector<std::vector<size_t>> adjacency(size);
+  for (size_t i = 0; i < edges.size(); i++) {
+    adjacency[edges[i].first].push_back(edges[i].second);
+    adjacency[edges[i].second].push_back(edges[i].first);
+  }
+  std::vector<bool> reached(size, false);
+  std::vector<size_t> stack(seeds);
+  while (!stack.empty()) {
+    size_t i = stack.back();
+    stack.pop_back();
+    if (reached[i]) continue;
+    reached[i] = true;
+    stack.insert(stack.end(), adjacency[i].begin(), adjacency[i].end());
+  }
+  return reached;
+}
+
+// a small isam problem built from scratch and solved once. isam does not
+// own its nodes and factors, so they are kept here and outlive the solver
+class Problem {
+ public:
+  size_t AddNode(Pose2D initial) {
+    nodes_.emplace_back(new isam::Pose2d_Node());
+    nodes_.back()->init(ToIsam(initial));
+    slam_.add_node(nodes_.back().get());
+    return nodes_.size() - 1;
+  }
+  void AddPrior(size_t node, Pose2D pose, double cov) {
+    isam::Noise noise = isam::Information(cov * isam::eye(3));
+    factors_.emplace_back(
+        new isam::Pose2d_Factor(nodes_[node].get(), ToIsam(pose), noise));
+    slam_.add_factor(factors_.back().get());
+  }
+  void AddRelative(size_t ref, size_t node, Pose2D pose, double cov) {
+    isam::Noise noise = isam::Information(cov * isam::eye(3));
+    factors_.emplace_back(new isam::Pose2d_Pose2d_Factor(
+          nodes_[ref].get(), nodes_[node].get(), ToIsam(pose), noise));
+    slam_.add_factor(factors_.back().get());
+  }
+  void Solve() {
+    slam_.batch_optimization();
+  }
+  Pose2D value(size_t node) const {
+    return FromIsam(nodes_[node]->value());
+  }
+
+ private:
+  std::vector<std::unique_ptr<isam::Pose2d_Node>> nodes_;
+  std::vector<std::unique_ptr<isam::Factor>> factors_;
+  // declared last, so it goes before what it points to
+  isam::Slam slam_;
+};
+
+}  // namespace
+
+HierarchicalGraph::Cluster::Cluster() {
+  anchor = 0;
+  dirty = false;
+}
+
+HierarchicalGraph::HierarchicalGraph(size_t cluster_size) {
+  cluster_size_ = cluster_size > 0 ? cluster_size : 1;
+  top_dirty_ = false;
+}
+
+size_t HierarchicalGraph::cluster_size() const {
+  return cluster_size_;
+}
+
+size_t HierarchicalGraph::cluster_count() const {
+  return clusters_.size();
+}
+
+bool HierarchicalGraph::has_node(size_t node_id) const {
+  return node_id < node_cluster_.size() && node_cluster_[node_id] >= 0;
+}
+
+Pose2D HierarchicalGraph::NodePose(size_t node_id) const {
+  return node_offset_[node_id] * clusters_[node_cluster_[node_id]].pose;
+}
+
+void HierarchicalGraph::InsertNode(size_t node_id, Pose2D pose) {
+  size_t index = node_id / cluster_size_;
+  if (index >= clusters_.size()) clusters_.resize(index + 1);
+  if (node_id >= node_cluster_.size()) {
+    node_cluster_.resize(node_id + 1, -1);
+    node_offset_.resize(node_id + 1);
+  }
+
+  Cluster &cluster = clusters_[index];
+  if (cluster.members.empty()) {
+    cluster.anchor = node_id;
+    cluster.pose = pose;
+    node_offset_[node_id] = Pose2D();
+  } else {
+    node_offset_[node_id] = pose * cluster.pose.inverse();
+  }
+  cluster.members.push_back(node_id);
+  cluster.dirty = true;
+  node_cluster_[node_id] = index;
+  top_dirty_ = true;
+}
+
+void HierarchicalGraph::AddPose2dFactor(size_t node_id, Pose2D pose,
+    double cov) {
+  if (cov <= 0) {
+    cov = 1.0;
+  }
+  if (!has_node(node_id)) InsertNode(node_id, pose);
+
+  Constraint constraint = {node_id, node_id, pose, cov, true, true};
+  constraints_.push_back(constraint);
+  top_dirty_ = true;
+}
+
+void HierarchicalGraph::AddPose2dPose2dFactor(size_t node_id_ref,
+    size_t node_id, Pose2D pose, double cov) {
+  if (cov <= 0) {
+    cov = 1.0;
+  }
+
+  // new nodes start where the measurement puts them
+  if (!has_node(node_id_ref)) {
+    if (has_node(node_id))
+      InsertNode(node_id_ref, pose.inverse() * NodePose(node_id));
+    else
+      InsertNode(node_id_ref, Pose2D());
+  }
+  if (!has_node(node_id))
+    InsertNode(node_id, pose * NodePose(node_id_ref));
+
+  Constraint constraint = {node_id_ref, node_id, pose, cov, false, true};
+  constraints_.push_back(constraint);
+  int ref_cluster = node_cluster_[node_id_ref];
+  if (ref_cluster == node_cluster_[node_id]) {
+    clusters_[ref_cluster].constraints.push_back(constraints_.size() - 1);
+    clusters_[ref_cluster].dirty = true;
+  }
+  top_dirty_ = true;
+}
+
+void HierarchicalGraph::remove(size_t node_id) {
+  if (!has_node(node_id)) return;
+  Cluster &cluster = clusters_[node_cluster_[node_id]];
+  for (size_t i = 0; i < constraints_.size(); i++) {
+    if (constraints_[i].ref == node_id || constraints_[i].node == node_id)
+      constraints_[i].active = false;
+  }
+  for (size_t i = 0; i < cluster.members.size(); i++) {
+    if (cluster.members[i] != node_id) continue;
+    cluster.members.erase(cluster.members.begin() + i);
+    break;
+  }
+  node_cluster_[node_id] = -1;
+
+  // the next member takes over the frame of the cluster
+  if (cluster.anchor == node_id && !cluster.members.empty()) {
+    size_t anchor = cluster.members.front();
+    Pose2D offset = node_offset_[anchor];
+    for (size_t i = 0; i < cluster.members.size(); i++) {
+      size_t member = cluster.members[i];
+      node_offset_[member] = node_offset_[member] * offset.inverse();
+    }
+    cluster.pose = offset * cluster.pose;
+    cluster.anchor = anchor;
+  }
+  cluster.dirty = true;
+  top_dirty_ = true;
+  Optimization();
+}
+
+std::vector<std::pair<size_t, Pose2D>> HierarchicalGraph::nodes() const {
+  std::vector<std::pair<size_t, Pose2D>> pose_id;
+  for (size_t i = 0; i < node_cluster_.size(); i++) {
+    if (!has_node(i)) continue;
+    pose_id.push_back(std::pair<size_t, Pose2D>(i, NodePose(i)));
+  }
+  return pose_id;
+}
+
+std::vector<std::pair<Eigen::Vector2d, Eigen::Vector2d>>
+HierarchicalGraph::factors() const {
+  std::vector<std::pair<Eigen::Vector2d, Eigen::Vector2d>> factors;
+  for (size_t i = 0; i < constraints_.size(); i++) {
+    const Constraint &constraint = constraints_[i];
+    if (!constraint.active || constraint.unary) continue;
+    factors.push_back(std::make_pair(NodePose(constraint.ref).pos(),
+          NodePose(constraint.node).pos()));
+  }
+  return factors;
+}
+
+void HierarchicalGraph::RefineCluster(Cluster *cluster) {
+  cluster->dirty = false;
+  if (cluster->members.size() < 2) return;
+
+  // solved in the anchor frame, where node poses are the offsets
+  Problem problem;
+  std::map<size_t, size_t> local;
+  for (size_t i = 0; i < cluster->members.size(); i++) {
+    size_t member = cluster->members[i];
+    local[member] = problem.AddNode(node_offset_[member]);
+  }
+  problem.AddPrior(local[cluster->anchor], Pose2D(), kAnchorInformation);
+
+  std::vector<std::pair<size_t, size_t>> edges;
+  for (size_t i = 0; i < cluster->constraints.size(); i++) {
+    const Constraint &constraint = constraints_[cluster->constraints[i]];
+    if (!constraint.active) continue;
+    size_t ref = local[constraint.ref];
+    size_t node = local[constraint.node];
+    problem.AddRelative(ref, node, constraint.pose, constraint.cov);
+    edges.push_back(std::make_pair(ref, node));
+  }
+
+  // members only tied to other clusters keep their offset
+  std::vector<bool> reached = Reachable(cluster->members.size(), edges,
+      std::vector<size_t>(1, local[cluster->anchor]));
+  for (size_t i = 0; i < reached.size(); i++) {
+    if (reached[i]) continue;
+    problem.AddPrior(i, node_offset_[cluster->members[i]],
+        kFloatingInformation);
+  }
+  problem.Solve();
+
+  Pose2D anchor = problem.value(local[cluster->anchor]);
+  for (size_t i = 0; i < cluster->members.size(); i++) {
+    size_t member = cluster->members[i];
+    node_offset_[member] = problem.value(local[member]) * anchor.inverse();
+  }
+}
+
+void HierarchicalGraph::OptimizeClusters() {
+  top_dirty_ = false;
+
+  // one node per non empty cluster, at the pose of its anchor
+  Problem problem;
+  std::vector<int> top(clusters_.size(), -1);
+  std::vector<size_t> clusters;
+  for (size_t i = 0; i < clusters_.size(); i++) {
+    if (clusters_[i].members.empty()) continue;
+    top[i] = problem.AddNode(clusters_[i].pose);
+    clusters.push_back(i);
+  }
+  if (clusters.empty()) return;
+
+  // constraints condensed onto the anchors through the current offsets
+  std::vector<std::pair<size_t, size_t>> edges;
+  std::vector<size_t> seeds;
+  for (size_t i = 0; i < constraints_.size(); i++) {
+    const Constraint &constraint = constraints_[i];
+    if (!constraint.active) continue;
+    int cluster_ref = node_cluster_[constraint.ref];
+    int cluster = node_cluster_[constraint.node];
+    if (constraint.unary) {
+      Pose2D offset = node_offset_[constraint.node];
+      problem.AddPrior(top[cluster], offset.inverse() * constraint.pose,
+          constraint.cov);
+      seeds.push_back(top[cluster]);
+      continue;
+    }
+    if (cluster_ref == cluster) continue;
+    Pose2D pose = node_offset_[constraint.node].inverse() * constraint.pose *
+      node_offset_[constraint.ref];
+    problem.AddRelative(top[cluster_ref], top[cluster], pose,
+        constraint.cov);
+    edges.push_back(std::make_pair(top[cluster_ref], top[cluster]));
+  }
+
+  // clusters without a path to a prior keep their pose
+  std::vector<bool> reached = Reachable(clusters.size(), edges, seeds);
+  for (size_t i = 0; i < reached.size(); i++) {
+    if (reached[i]) continue;
+    problem.AddPrior(i, clusters_[clusters[i]].pose, kFloatingInformation);
+    std::vector<bool> more = Reachable(clusters.size(), edges,
+        std::vector<size_t>(1, i));
+    for (size_t j = 0; j < reached.size(); j++)
+      reached[j] = reached[j] || more[j];
+  }
+  problem.Solve();
+
+  for (size_t i = 0; i < clusters.size(); i++)
+    clusters_[clusters[i]].pose = problem.value(i);
+}
+
+void HierarchicalGraph::Optimization() {
+  for (size_t i = 0; i < clusters_.size(); i++) {
+    if (!clusters_[i].dirty) continue;
+    RefineCluster(&clusters_[i]);
+    top_dirty_ = true;
+  }
+  if (top_dirty_) OptimizeClusters();
+}
+
+}  // namespace pgslam
+
+#endif  // USE_ISAM
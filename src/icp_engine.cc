@@ -0,0 +1,120 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/icp_engine.h>
+
+namespace pgslam {
+namespace icp {
+
+namespace {
+
+// everything one run of an engine needs
+template <typename Scalar>
+struct Problem {
+  typedef Eigen::Matrix<Scalar, 2, Eigen::Dynamic> Points;
+  const MatchConfig &config;
+  const Geometry &geometry;
+  const Points &reference;
+  const Points &query;
+  Pose2D initial;
+  const MatchBudget &budget;
+};
+
+template <typename Scalar, class Correspondence, class Rejection,
+         class Solver>
+MatchResult Run(const Problem<Scalar> &problem) {
+  Engine<Scalar, Correspondence, Rejection, Solver> engine(problem.config,
+      problem.geometry);
+  return engine.Match(problem.reference, problem.query, problem.initial,
+      problem.budget);
+}
+
+template <typename Scalar, class Correspondence, class Rejection>
+MatchResult RunWithRejection(const Problem<Scalar> &problem) {
+  switch (problem.config.solver) {
+    case Solver::kSVD:
+      return Run<Scalar, Correspondence, Rejection,
+             SVDSolver<Scalar>>(problem);
+    case Solver::kPointToLine:
+      return Run<Scalar, Correspondence, Rejection,
+             PointToLineSolver<Scalar>>(problem);
+    default:
+      return Run<Scalar, Correspondence, Rejection,
+             HeuristicSolver<Scalar>>(problem);
+  }
+}
+
+template <typename Scalar, class Correspondence>
+MatchResult RunWith(const Problem<Scalar> &problem) {
+  switch (problem.config.rejection) {
+    case Rejection::kRobust:
+      return RunWithRejection<Scalar, Correspondence,
+             WeightedRejection<Scalar>>(problem);
+    case Rejection::kDuplicate:
+      return RunWithRejection<Scalar, Correspondence,
+             DuplicateRejection<Scalar>>(problem);
+    default:
+      return RunWithRejection<Scalar, Correspondence,
+             TrimmedRejection<Scalar>>(problem);
+  }
+}
+
+}  // namespace
+
+template <typename Scalar>
+MatchResult Match(Association association, const MatchConfig &config,
+    const Geometry &geometry,
+    const Eigen::Matrix<Scalar, 2, Eigen::Dynamic> &reference,
+    const Eigen::Matrix<Scalar, 2, Eigen::Dynamic> &query, Pose2D initial,
+    const MatchBudget &budget) {
+  Problem<Scalar> problem = {config, geometry, reference, query, initial,
+    budget};
+  if (association == Association::kProjective &&
+      geometry.angle_increment == 0.0)
+    association = Association::kAuto;
+  if (association == Association::kAuto) {
+    switch (nn_search::SelectBackend(reference, query.cols(),
+          config.dist_threshold)) {
+      case nn_search::Backend::kBruteForce:
+        association = Association::kBruteForce;
+        break;
+      case nn_search::Backend::kGrid:
+        association = Association::kGrid;
+        break;
+      default:
+        association = Association::kKDTree;
+        break;
+    }
+  }
+  switch (association) {
+    case Association::kProjective:
+      return RunWith<Scalar, ProjectiveCorrespondence<Scalar>>(problem);
+    case Association::kBruteForce:
+      return RunWith<Scalar, BruteForceCorrespondence<Scalar>>(problem);
+    case Association::kGrid:
+      return RunWith<Scalar, GridCorrespondence<Scalar>>(problem);
+    default:
+      return RunWith<Scalar, KDTreeCorrespondence<Scalar>>(problem);
+  }
+}
+
+template MatchResult Match<double>(Association association,
+    const MatchConfig &config, const Geometry &geometry,
+    const Eigen::Matrix2Xd &reference, const Eigen::Matrix2Xd &query,
+    Pose2D initial, const MatchBudget &budget);
+template MatchResult Match<float>(Association association,
+    const MatchConfig &config, const Geometry &geometry,
+    const Eigen::Matrix2Xf &reference, const Eigen::Matrix2Xf &query,
+    Pose2D initial, const MatchBudget &budget);
+
+template class Engine<double, KDTreeCorrespondence<double>,
+         TrimmedRejection<double>, HeuristicSolver<double>>;
+template class Engine<double, ProjectiveCorrespondence<double>,
+         TrimmedRejection<double>, HeuristicSolver<double>>;
+template class Engine<float, KDTreeCorrespondence<float>,
+         TrimmedRejection<float>, HeuristicSolver<float>>;
+template class Engine<float, ProjectiveCorrespondence<float>,
+         TrimmedRejection<float>, HeuristicSolver<float>>;
+
+}  // namespace icp
+}  // namespace pgslam
@@ -6,7 +6,8 @@
 
 namespace kd_tree_2d {
 
-Node::Node(Eigen::Vector2d point, size_t index, int dir) {
+template <typename Scalar>
+Node<Scalar>::Node(Point point, size_t index, int dir) {
   this->point = point;
   this->index = index;
   left = nullptr;
@@ -14,11 +15,16 @@ Node::Node(Eigen::Vector2d point, size_t index, int dir) {
   this->dir = dir;
 }
 
-Eigen::Vector2d Node::get_point() { return point; }
+template <typename Scalar>
+typename Node<Scalar>::Point Node<Scalar>::get_point() const {
+  return point;
+}
 
-size_t Node::get_index() { return index; }
+template <typename Scalar>
+size_t Node<Scalar>::get_index() const { return index; }
 
-void Node::insert(Eigen::Vector2d point, size_t index) {
+template <typename Scalar>
+void Node<Scalar>::insert(Point point, size_t index) {
   if (point(dir) <= this->point(dir)) {
     if (left == nullptr) {
       left = new Node(point, index, (dir+1)%2);
@@ -34,10 +40,11 @@ void Node::insert(Eigen::Vector2d point, size_t index) {
   }
 }
 
-Node * Node::Nearest(Eigen::Vector2d point) {
-  Node *near_side, *far_side;
-  Node *nearside_best = nullptr;
-  Node *farside_best  = nullptr;
+template <typename Scalar>
+const Node<Scalar> * Node<Scalar>::Nearest(Point point) const {
+  const Node *near_side, *far_side;
+  const Node *nearside_best = nullptr;
+  const Node *farside_best  = nullptr;
   if (left == nullptr && right == nullptr)
     return this;
   if (point(dir) <= this->point(dir)) {
@@ -59,7 +66,7 @@ Node * Node::Nearest(Eigen::Vector2d point) {
       farside_best = far_side->Nearest(point);
     }
   }
-  Node * best = this;
+  const Node * best = this;
   if (nearside_best != nullptr &&
       (nearside_best->point-point).norm() < (best->point-point).norm()) {
     best = nearside_best;
@@ -71,26 +78,30 @@ Node * Node::Nearest(Eigen::Vector2d point) {
   return best;
 }
 
-Node::~Node() {
+template <typename Scalar>
+Node<Scalar>::~Node() {
   if (left != nullptr)
     delete left;
   if (right != nullptr)
     delete right;
 }
 
-KDTree2D::KDTree2D() {
+template <typename Scalar>
+BasicKDTree2D<Scalar>::BasicKDTree2D() {
   root = nullptr;
 }
 
-void KDTree2D::insert(Eigen::Vector2d point, size_t index) {
+template <typename Scalar>
+void BasicKDTree2D<Scalar>::insert(Point point, size_t index) {
   if (root == nullptr) {
-    root = new Node(point, index, 0);
+    root = new Node<Scalar>(point, index, 0);
   } else {
     root->insert(point, index);
   }
 }
 
-void KDTree2D::Construct(const std::vector<Eigen::Vector2d> &points) {
+template <typename Scalar>
+void BasicKDTree2D<Scalar>::Construct(const std::vector<Point> &points) {
   std::vector<size_t> index;
   for (size_t i = 0; i < points.size(); i++)
     index.push_back(i);
@@ -107,7 +118,8 @@ void KDTree2D::Construct(const std::vector<Eigen::Vector2d> &points) {
   }
 }
 
-void KDTree2D::Construct(const Eigen::Matrix2Xd& points) {
+template <typename Scalar>
+void BasicKDTree2D<Scalar>::Construct(const Points& points) {
   std::vector<size_t> index;
   for (size_t i = 0; i < points.cols(); i++)
     index.push_back(i);
@@ -124,7 +136,9 @@ void KDTree2D::Construct(const Eigen::Matrix2Xd& points) {
   }
 }
 
-Eigen::Vector2d KDTree2D::Nearest(Eigen::Vector2d point) {
+template <typename Scalar>
+typename BasicKDTree2D<Scalar>::Point BasicKDTree2D<Scalar>::Nearest(
+    Point point) const {
   assert(root != nullptr);
   auto result = root->Nearest(point);
   if (result == nullptr) {
@@ -134,7 +148,8 @@ Eigen::Vector2d KDTree2D::Nearest(Eigen::Vector2d point) {
   }
 }
 
-size_t KDTree2D::NearestIndex(Eigen::Vector2d point) {
+template <typename Scalar>
+size_t BasicKDTree2D<Scalar>::NearestIndex(Point point) const {
   assert(root != nullptr);
   auto result = root->Nearest(point);
   if (result == nullptr) {
@@ -144,9 +159,15 @@ size_t KDTree2D::NearestIndex(Eigen::Vector2d point) {
   }
 }
 
-KDTree2D::~KDTree2D() {
+template <typename Scalar>
+BasicKDTree2D<Scalar>::~BasicKDTree2D() {
   delete root;
 }
 
+template class Node<double>;
+template class Node<float>;
+template class BasicKDTree2D<double>;
+template class BasicKDTree2D<float>;
+
 }  // namespace kd_tree_2d
 
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/landmark.h>
+
+#include <algorithm>
+#include <tuple>
+
+namespace pgslam {
+
+namespace {
+
+// bright points of one marker, summed up
+struct Cluster {
+  Cluster() : sum(Eigen::Vector2d::Zero()), count(0) {}
+  Eigen::Vector2d center() const { return sum / count; }
+  Eigen::Vector2d first;
+  Eigen::Vector2d sum;
+  int count;
+};
+
+}  // namespace
+
+std::vector<Eigen::Vector2d> ExtractReflectors(const LaserScan &scan,
+    const LandmarkConfig &config) {
+  const Eigen::Matrix2Xd &points = scan.local_points();
+  const Eigen::VectorXd &intensities = scan.intensities();
+  std::vector<Cluster> clusters;
+  if (config.intensity <= 0.0 || intensities.size() != points.cols())
+    return std::vector<Eigen::Vector2d>();
+
+  for (const Lidar &lidar : scan.lidars()) {
+    Cluster cluster;
+    bool wide = false;
+    Eigen::Vector2d last;
+    for (size_t i = lidar.first; i <= lidar.first + lidar.count; i++) {
+      bool bright = i < lidar.first + lidar.count &&
+        intensities(i) >= config.intensity && points.col(i).allFinite();
+      // a gap between neighbouring bright beams starts another run
+      bool joins = bright && cluster.count > 0 &&
+        (points.col(i) - last).norm() <= config.max_size;
+      if (cluster.count > 0 && !joins) {
+        // a bright wall is no marker
+        if (cluster.count >= config.min_points && !wide)
+          clusters.push_back(cluster);
+        cluster = Cluster();
+        wide = false;
+      }
+      if (!bright) continue;
+      if (cluster.count == 0) cluster.first = points.col(i);
+      wide = wide || (points.col(i) - cluster.first).norm() > config.max_size;
+      cluster.sum += points.col(i);
+      cluster.count++;
+      last = points.col(i);
+    }
+  }
+
+  // the parts of one marker seen by two lidars or split by the seam
+  std::vector<Eigen::Vector2d> reflectors;
+  for (size_t i = 0; i < clusters.size(); i++) {
+    if (clusters[i].count == 0) continue;
+    for (size_t j = i + 1; j < clusters.size(); j++) {
+      if (clusters[j].count == 0 || (clusters[i].center() -
+            clusters[j].center()).norm() > config.max_size) continue;
+      clusters[i].sum += clusters[j].sum;
+      clusters[i].count += clusters[j].count;
+      clusters[j].count = 0;
+    }
+    reflectors.push_back(clusters[i].center());
+  }
+  return reflectors;
+}
+
+std::vector<int> AssociateReflectors(
+    const std::vector<Eigen::Vector2d> &reflectors, Pose2D pose,
+    const std::vector<Eigen::Vector2d> &landmarks, double gate) {
+  // every pair within the gate, the closest taken first
+  std::vector<std::tuple<double, size_t, size_t>> pairs;
+  auto to_world = pose.ToTransform();
+  for (size_t i = 0; i < reflectors.size(); i++) {
+    Eigen::Vector2d world = to_world * reflectors[i];
+    for (size_t j = 0; j < landmarks.size(); j++) {
+      double distance = (landmarks[j] - world).norm();
+      if (distance < gate)
+        pairs.push_back(std::make_tuple(distance, i, j));
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+
+  std::vector<int> associations(reflectors.size(), -1);
+  std::vector<bool> taken(landmarks.size(), false);
+  for (const auto &pair : pairs) {
+    size_t i = std::get<1>(pair);
+    size_t j = std::get<2>(pair);
+    if (associations[i] >= 0 || taken[j]) continue;
+    associations[i] = j;
+    taken[j] = true;
+  }
+  return associations;
+}
+
+}  // namespace pgslam
@@ -0,0 +1,450 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/lidar_simulator.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+namespace pgslam {
+
+namespace {
+
+const double kWallThickness = 0.1;
+const double kDoorWidth = 1.0;
+
+double NormalizeAngle(double angle) {
+  while (angle < -M_PI) angle += 2 * M_PI;
+  while (angle >  M_PI) angle -= 2 * M_PI;
+  return angle;
+}
+
+// next token of a pgm header, skipping comments
+bool PgmToken(std::istream *in, int *value) {
+  *in >> std::ws;
+  while (in->peek() == '#') {
+    std::string comment;
+    std::getline(*in, comment);
+    *in >> std::ws;
+  }
+  return static_cast<bool>(*in >> *value);
+}
+
+}  // namespace
+
+World::World() {
+  resolution_ = 0.05;
+  origin_ = Eigen::Vector2d(0.0, 0.0);
+  width_ = 0;
+  height_ = 0;
+}
+
+World::World(double resolution, Eigen::Vector2d origin, int width,
+    int height) {
+  resolution_ = resolution;
+  origin_ = origin;
+  width_ = width;
+  height_ = height;
+  cells_.assign(static_cast<size_t>(width_) * height_, 0);
+}
+
+bool World::Load(const std::string &yaml, World *world) {
+  std::ifstream in(yaml.c_str());
+  if (!in) {
+    std::cout << "Error: cannot open " << yaml << std::endl;
+    return false;
+  }
+  // the flat keys map_server writes are all that is read
+  std::string image;
+  double resolution = 0.05;
+  Eigen::Vector2d origin(0.0, 0.0);
+  int negate = 0;
+  double occupied_thresh = 0.65;
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) continue;
+    std::string key = line.substr(0, colon);
+    std::string value = line.substr(colon + 1);
+    std::replace(value.begin(), value.end(), '[', ' ');
+    std::replace(value.begin(), value.end(), ']', ' ');
+    std::replace(value.begin(), value.end(), ',', ' ');
+    std::istringstream fields(value);
+    if (key == "image") {
+      fields >> image;
+    } else if (key == "resolution") {
+      fields >> resolution;
+    } else if (key == "origin") {
+      fields >> origin.x() >> origin.y();
+    } else if (key == "negate") {
+      fields >> negate;
+    } else if (key == "occupied_thresh") {
+      fields >> occupied_thresh;
+    }
+  }
+  if (!image.empty() && image[0] != '/') {
+    size_t slash = yaml.find_last_of('/');
+    if (slash != std::string::npos)
+      image = yaml.substr(0, slash + 1) + image;
+  }
+
+  std::ifstream pgm(image.c_str(), std::ios::binary);
+  std::string magic;
+  pgm >> magic;
+  int width = 0;
+  int height = 0;
+  int max_value = 0;
+  if (!pgm || (magic != "P5" && magic != "P2") || !PgmToken(&pgm, &width) ||
+      !PgmToken(&pgm, &height) || !PgmToken(&pgm, &max_value) ||
+      width <= 0 || height <= 0 || max_value <= 0 || max_value > 255) {
+    std::cout << "Error: cannot read " << image << ", only 8 bit pgm"
+      << std::endl;
+    return false;
+  }
+  pgm.get();  // the single white space before binary data
+
+  *world = World(resolution, origin, width, height);
+  std::vector<unsigned char> row(width);
+  // the first image row is the top of the map
+  for (int y = height - 1; y >= 0; y--) {
+    if (magic == "P5") {
+      pgm.read(reinterpret_cast<char *>(row.data()), width);
+    } else {
+      for (int x = 0; x < width; x++) {
+        int value = 0;
+        pgm >> value;
+        row[x] = value;
+      }
+    }
+    if (!pgm) {
+      std::cout << "Error: " << image << " is truncated" << std::endl;
+      return false;
+    }
+    for (int x = 0; x < width; x++) {
+      double occupancy = static_cast<double>(row[x]) / max_value;
+      if (!negate) occupancy = 1.0 - occupancy;
+      world->set_occupied(x, y, occupancy > occupied_thresh);
+    }
+  }
+  return true;
+}
+
+World World::Generate(int rooms_x, int rooms_y, double room_size,
+    double resolution, unsigned int seed) {
+  rooms_x = std::max(rooms_x, 1);
+  rooms_y = std::max(rooms_y, 1);
+  double margin = 1.0;
+  Eigen::Vector2d size(rooms_x * room_size, rooms_y * room_size);
+  World world(resolution, Eigen::Vector2d(-margin, -margin),
+      (size.x() + 2 * margin) / resolution,
+      (size.y() + 2 * margin) / resolution);
+
+  double half_wall = kWallThickness / 2;
+  double half_door = std::min(kDoorWidth, room_size / 3) / 2;
+  for (int i = 0; i <= rooms_x; i++) {  // walls along y
+    double x = i * room_size;
+    for (int j = 0; j < rooms_y; j++) {
+      double y0 = j * room_size;
+      double y1 = y0 + room_size;
+      if (i == 0 || i == rooms_x) {
+        world.FillBox(Eigen::Vector2d(x - half_wall, y0 - half_wall),
+            Eigen::Vector2d(x + half_wall, y1 + half_wall));
+        continue;
+      }
+      double door = (y0 + y1) / 2;
+      world.FillBox(Eigen::Vector2d(x - half_wall, y0 - half_wall),
+          Eigen::Vector2d(x + half_wall, door - half_door));
+      world.FillBox(Eigen::Vector2d(x - half_wall, door + half_door),
+          Eigen::Vector2d(x + half_wall, y1 + half_wall));
+    }
+  }
+  for (int j = 0; j <= rooms_y; j++) {  // walls along x
+    double y = j * room_size;
+    for (int i = 0; i < rooms_x; i++) {
+      double x0 = i * room_size;
+      double x1 = x0 + room_size;
+      if (j == 0 || j == rooms_y) {
+        world.FillBox(Eigen::Vector2d(x0 - half_wall, y - half_wall),
+            Eigen::Vector2d(x1 + half_wall, y + half_wall));
+        continue;
+      }
+      double door = (x0 + x1) / 2;
+      world.FillBox(Eigen::Vector2d(x0 - half_wall, y - half_wall),
+          Eigen::Vector2d(door - half_door, y + half_wall));
+      world.FillBox(Eigen::Vector2d(door + half_door, y - half_wall),
+          Eigen::Vector2d(x1 + half_wall, y + half_wall));
+    }
+  }
+
+  // boxes sit in the room quadrants, clear of the lines between centers
+  std::mt19937 random(seed);
+  std::bernoulli_distribution place(0.5);
+  double half_box = room_size / 12;
+  for (int j = 0; j < rooms_y; j++) {
+    for (int i = 0; i < rooms_x; i++) {
+      Eigen::Vector2d center = room_size * Eigen::Vector2d(i + 0.5, j + 0.5);
+      for (int k = 0; k < 4; k++) {
+        if (!place(random)) continue;
+        Eigen::Vector2d spot = center + room_size / 4 *
+          Eigen::Vector2d(k % 2 ? 1.0 : -1.0, k / 2 ? 1.0 : -1.0);
+        world.FillBox(spot - Eigen::Vector2d(half_box, half_box),
+            spot + Eigen::Vector2d(half_box, half_box));
+      }
+    }
+  }
+
+  // back and forth through the rows, then down a column and along the
+  // first row home, so the loop closes where it started
+  std::vector<Eigen::Vector2d> waypoints;
+  int column = 0;
+  for (int j = 0; j < rooms_y; j++) {
+    for (int k = 0; k < rooms_x; k++) {
+      column = j % 2 ? rooms_x - 1 - k : k;
+      waypoints.push_back(room_size * Eigen::Vector2d(column + 0.5, j + 0.5));
+    }
+  }
+  for (int j = rooms_y - 2; j >= 0; j--)
+    waypoints.push_back(room_size * Eigen::Vector2d(column + 0.5, j + 0.5));
+  for (int i = column - 1; i > 0; i--)
+    waypoints.push_back(room_size * Eigen::Vector2d(i + 0.5, 0.5));
+  if (waypoints.size() < 2) {  // a single room, go round its center
+    Eigen::Vector2d center = waypoints.front();
+    double r = room_size / 8;
+    waypoints.clear();
+    waypoints.push_back(center + Eigen::Vector2d(-r, -r));
+    waypoints.push_back(center + Eigen::Vector2d(r, -r));
+    waypoints.push_back(center + Eigen::Vector2d(r, r));
+    waypoints.push_back(center + Eigen::Vector2d(-r, r));
+  }
+  world.set_waypoints(waypoints);
+  return world;
+}
+
+double World::resolution() const { return resolution_; }
+Eigen::Vector2d World::origin() const { return origin_; }
+int World::width() const { return width_; }
+int World::height() const { return height_; }
+
+bool World::occupied(int x, int y) const {
+  if (x < 0 || x >= width_ || y < 0 || y >= height_) return false;
+  return cells_[static_cast<size_t>(y) * width_ + x];
+}
+
+void World::set_occupied(int x, int y, bool occupied) {
+  if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
+  cells_[static_cast<size_t>(y) * width_ + x] = occupied;
+}
+
+const std::vector<Eigen::Vector2d> & World::waypoints() const {
+  return waypoints_;
+}
+
+void World::set_waypoints(const std::vector<Eigen::Vector2d> &waypoints) {
+  waypoints_ = waypoints;
+}
+
+void World::FillBox(Eigen::Vector2d min, Eigen::Vector2d max) {
+  int x0 = floor((min.x() - origin_.x()) / resolution_);
+  int y0 = floor((min.y() - origin_.y()) / resolution_);
+  int x1 = floor((max.x() - origin_.x()) / resolution_);
+  int y1 = floor((max.y() - origin_.y()) / resolution_);
+  for (int y = y0; y <= y1; y++) {
+    for (int x = x0; x <= x1; x++)
+      set_occupied(x, y, true);
+  }
+}
+
+double World::Cast(const Eigen::Vector2d &from, double angle,
+    double range) const {
+  // walk the cells the ray crosses, distances in cells
+  const double kInf = std::numeric_limits<double>::infinity();
+  Eigen::Vector2d p = (from - origin_) / resolution_;
+  Eigen::Vector2d dir(cos(angle), sin(angle));
+  int x = floor(p.x());
+  int y = floor(p.y());
+  int step_x = dir.x() > 0 ? 1 : -1;
+  int step_y = dir.y() > 0 ? 1 : -1;
+  double delta_x = dir.x() != 0 ? std::abs(1.0 / dir.x()) : kInf;
+  double delta_y = dir.y() != 0 ? std::abs(1.0 / dir.y()) : kInf;
+  double next_x = (dir.x() > 0 ? x + 1 - p.x() : p.x() - x) * delta_x;
+  double next_y = (dir.y() > 0 ? y + 1 - p.y() : p.y() - y) * delta_y;
+  if (dir.x() == 0) next_x = kInf;
+  if (dir.y() == 0) next_y = kInf;
+  double end = range / resolution_;
+  double t = 0.0;
+  while (t <= end) {
+    if (occupied(x, y)) return t * resolution_;
+    // nothing left to hit once outside and heading away
+    if ((x < 0 && step_x < 0) || (x >= width_ && step_x > 0) ||
+        (y < 0 && step_y < 0) || (y >= height_ && step_y > 0))
+      break;
+    if (next_x < next_y) {
+      t = next_x;
+      next_x += delta_x;
+      x += step_x;
+    } else {
+      t = next_y;
+      next_y += delta_y;
+      y += step_y;
+    }
+  }
+  return kInf;
+}
+
+Trajectory::Trajectory(const std::vector<Eigen::Vector2d> &waypoints,
+    double speed, double turn_rate) {
+  speed_ = speed > 0 ? speed : 1.0;
+  turn_rate_ = turn_rate > 0 ? turn_rate : 1.0;
+  period_ = 0.0;
+
+  // waypoints that do not move the robot make no leg
+  std::vector<Eigen::Vector2d> points;
+  for (size_t i = 0; i < waypoints.size(); i++) {
+    if (points.empty() || (waypoints[i] - points.back()).norm() > 1e-9)
+      points.push_back(waypoints[i]);
+  }
+  while (points.size() > 1 && (points.back() - points.front()).norm() < 1e-9)
+    points.pop_back();
+  if (points.size() < 2) {
+    Leg stay = {0.0, points.empty() ? Eigen::Vector2d(0.0, 0.0) :
+      points.front(), 0.0, 0.0, 0.0};
+    legs_.push_back(stay);
+    return;
+  }
+
+  std::vector<double> headings(points.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    Eigen::Vector2d v = points[(i + 1) % points.size()] - points[i];
+    headings[i] = atan2(v.y(), v.x());
+  }
+  for (size_t i = 0; i < points.size(); i++) {
+    Leg leg;
+    leg.start = period_;
+    leg.from = points[i];
+    leg.heading = headings[(i + points.size() - 1) % points.size()];
+    leg.turn = NormalizeAngle(headings[i] - leg.heading);
+    leg.length = (points[(i + 1) % points.size()] - points[i]).norm();
+    legs_.push_back(leg);
+    period_ += std::abs(leg.turn) / turn_rate_ + leg.length / speed_;
+  }
+}
+
+double Trajectory::period() const {
+  return period_;
+}
+
+Pose2D Trajectory::At(double time) const {
+  if (period_ <= 0.0) {
+    const Leg &stay = legs_.front();
+    return Pose2D(stay.from.x(), stay.from.y(), stay.heading);
+  }
+  time = fmod(time, period_);
+  if (time < 0.0) time += period_;
+  size_t k = legs_.size() - 1;
+  while (k > 0 && legs_[k].start > time) k--;
+  const Leg &leg = legs_[k];
+
+  double elapsed = time - leg.start;
+  double turn_time = std::abs(leg.turn) / turn_rate_;
+  if (elapsed < turn_time) {
+    double heading = leg.heading +
+      (leg.turn > 0 ? 1.0 : -1.0) * turn_rate_ * elapsed;
+    return Pose2D(leg.from.x(), leg.from.y(), heading);
+  }
+  double heading = leg.heading + leg.turn;
+  double distance = std::min((elapsed - turn_time) * speed_, leg.length);
+  Eigen::Vector2d pos = leg.from +
+    distance * Eigen::Vector2d(cos(heading), sin(heading));
+  return Pose2D(pos.x(), pos.y(), heading);
+}
+
+SimulatorConfig::SimulatorConfig() {
+  beams = 1440;
+  rate = 50.0;
+  angle_min = -M_PI;
+  angle_max = M_PI;
+  range_max = 30.0;
+  range_noise = 0.01;
+  dropout = 0.0;
+  odometry_noise = 0.02;
+  heading_noise = 0.01;
+  speed = 1.0;
+  turn_rate = 1.0;
+  seed = 0;
+}
+
+LidarSimulator::LidarSimulator(const World &world,
+    const SimulatorConfig &config)
+  : world_(world), config_(config),
+    trajectory_(world.waypoints(), config.speed, config.turn_rate),
+    random_(config.seed) {
+  config_.beams = std::max(config_.beams, 1);
+  config_.rate = config_.rate > 0 ? config_.rate : 1.0;
+  count_ = 0;
+  last_truth_ = trajectory_.At(0.0);
+  odometry_ = Pose2D();
+}
+
+const SimulatorConfig & LidarSimulator::config() const {
+  return config_;
+}
+
+const Trajectory & LidarSimulator::trajectory() const {
+  return trajectory_;
+}
+
+double LidarSimulator::angle_increment() const {
+  return (config_.angle_max - config_.angle_min) / config_.beams;
+}
+
+SimulatedScan LidarSimulator::Next() {
+  double period = 1.0 / config_.rate;
+  double start = count_++ * period;
+  double increment = angle_increment();
+  std::normal_distribution<double> noise(0.0, config_.range_noise);
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+  SimulatedScan scan;
+  scan.time_stamp = static_cast<int64_t>(start * 1e9);
+  scan.truth = trajectory_.At(start);
+  scan.odometry = Odometry(scan.truth);
+  scan.echos.reserve(config_.beams);
+  for (int i = 0; i < config_.beams; i++) {
+    double time = start + period * i / config_.beams;
+    Pose2D pose = trajectory_.At(time);
+    double angle = config_.angle_min + increment * i;
+    double range = world_.Cast(pose.pos(), pose.theta() + angle,
+        config_.range_max);
+    if (config_.dropout > 0.0 && chance(random_) < config_.dropout)
+      range = std::numeric_limits<double>::infinity();
+    if (std::isfinite(range) && config_.range_noise > 0.0)
+      range = std::max(0.0, range + noise(random_));
+    double intensity = std::isfinite(range) ? 100.0 : 0.0;
+    scan.echos.push_back(Echo(range, angle, intensity,
+          static_cast<int64_t>(time * 1e9)));
+  }
+  return scan;
+}
+
+// the true motion since the last scan, in the robot frame, with noise
+// growing with the distance and angle covered
+Pose2D LidarSimulator::Odometry(Pose2D truth) {
+  Pose2D delta = truth * last_truth_.inverse();
+  last_truth_ = truth;
+  double distance = delta.pos().norm();
+  std::normal_distribution<double> unit(0.0, 1.0);
+  double sigma = config_.odometry_noise * distance;
+  double heading_sigma = config_.heading_noise *
+    (std::abs(delta.theta()) + distance);
+  Pose2D noisy(delta.x() + sigma * unit(random_),
+      delta.y() + sigma * unit(random_),
+      delta.theta() + heading_sigma * unit(random_));
+  odometry_ = noisy * odometry_;
+  return odometry_;
+}
+
+}  // namespace pgslam
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/map_export.h>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace pgslam {
+
+// occupancy thresholds of map_server, in percent and as written to yaml
+const int kFreeThreshold = 25;
+const int kOccupiedThreshold = 65;
+const double kFreeThresh = 0.196;
+const double kOccupiedThresh = 0.65;
+// bytes of compressed data per png IDAT chunk
+const size_t kChunkSize = 1 << 16;
+
+namespace {
+
+// same trinary gray levels as map_saver
+uint8_t Pixel(int8_t value) {
+  if (value >= 0 && value <= kFreeThreshold) return 254;
+  if (value >= kOccupiedThreshold) return 0;
+  return 205;
+}
+
+class ImageWriter {
+ public:
+  virtual ~ImageWriter() {}
+  virtual bool Begin(std::ofstream *out, int width, int height) = 0;
+  virtual bool WriteRow(const std::vector<uint8_t> &row) = 0;
+  virtual bool End() = 0;
+};
+
+class PgmWriter : public ImageWriter {
+ public:
+  bool Begin(std::ofstream *out, int width, int height) {
+    out_ = out;
+    *out_ << "P5\n# CREATOR: pgslam\n" << width << " " << height
+      << "\n255\n";
+    return out_->good();
+  }
+  bool WriteRow(const std::vector<uint8_t> &row) {
+    out_->write(reinterpret_cast<const char *>(row.data()), row.size());
+    return out_->good();
+  }
+  bool End() {
+    out_->flush();
+    return out_->good();
+  }
+
+ private:
+  std::ofstream *out_;
+};
+
+// 8 bit gray png, rows deflated as they come and flushed in IDAT chunks
+class PngWriter : public ImageWriter {
+ public:
+  PngWriter() : started_(false) {}
+  ~PngWriter() {
+    if (started_) deflateEnd(&stream_);
+  }
+  bool Begin(std::ofstream *out, int width, int height) {
+    out_ = out;
+    static const uint8_t kSignature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    out_->write(reinterpret_cast<const char *>(kSignature), 8);
+    std::vector<uint8_t> header;
+    PutInt(&header, width);
+    PutInt(&header, height);
+    // bit depth, gray, deflate, no filter method, no interlace
+    const uint8_t kRest[5] = {8, 0, 0, 0, 0};
+    header.insert(header.end(), kRest, kRest + 5);
+    WriteChunk("IHDR", header);
+
+    stream_.zalloc = Z_NULL;
+    stream_.zfree = Z_NULL;
+    stream_.opaque = Z_NULL;
+    if (deflateInit(&stream_, Z_DEFAULT_COMPRESSION) != Z_OK) {
+      std::cout << "Error: cannot initialize deflate" << std::endl;
+      return false;
+    }
+    started_ = true;
+    buffer_.resize(kChunkSize);
+    stream_.next_out = buffer_.data();
+    stream_.avail_out = buffer_.size();
+    return out_->good();
+  }
+  bool WriteRow(const std::vector<uint8_t> &row) {
+    row_.assign(1, 0);  // filter type none
+    row_.insert(row_.end(), row.begin(), row.end());
+    stream_.next_in = row_.data();
+    stream_.avail_in = row_.size();
+    return Deflate(Z_NO_FLUSH);
+  }
+  bool End() {
+    stream_.next_in = Z_NULL;
+    stream_.avail_in = 0;
+    if (!Deflate(Z_FINISH)) return false;
+    WriteChunk("IEND", std::vector<uint8_t>());
+    out_->flush();
+    return out_->good();
+  }
+
+ private:
+  static void PutInt(std::vector<uint8_t> *data, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+      data->push_back((value >> shift) & 0xff);
+  }
+  void WriteChunk(const char *type, const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> length;
+    PutInt(&length, data.size());
+    out_->write(reinterpret_cast<const char *>(length.data()), 4);
+    out_->write(type, 4);
+    out_->write(reinterpret_cast<const char *>(data.data()), data.size());
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(type), 4);
+    // a null buffer would reset the crc instead of leaving it alone
+    if (!data.empty()) crc = crc32(crc, data.data(), data.size());
+    std::vector<uint8_t> tail;
+    PutInt(&tail, crc);
+    out_->write(reinterpret_cast<const char *>(tail.data()), 4);
+  }
+  bool Deflate(int flush) {
+    while (true) {
+      int ret = deflate(&stream_, flush);
+      if (ret == Z_STREAM_ERROR) {
+        std::cout << "Error: deflate failed" << std::endl;
+        return false;
+      }
+      // a full buffer is one IDAT chunk
+      if (stream_.avail_out == 0 || (flush == Z_FINISH &&
+            stream_.avail_out < buffer_.size())) {
+        std::vector<uint8_t> chunk(buffer_.begin(),
+            buffer_.begin() + (buffer_.size() - stream_.avail_out));
+        WriteChunk("IDAT", chunk);
+        stream_.next_out = buffer_.data();
+        stream_.avail_out = buffer_.size();
+      }
+      if (flush == Z_FINISH ? ret == Z_STREAM_END : stream_.avail_in == 0)
+        break;
+    }
+    return out_->good();
+  }
+
+ private:
+  std::ofstream *out_;
+  z_stream stream_;
+  bool started_;
+  std::vector<uint8_t> buffer_;
+  std::vector<uint8_t> row_;
+};
+
+std::string BaseName(const std::string &path) {
+  size_t slash = path.find_last_of('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+}  // namespace
+
+MapExporter::MapExporter(double resolution, Eigen::Vector2d origin,
+    int width, int height) {
+  resolution_ = resolution;
+  origin_ = origin;
+  width_ = width;
+  height_ = height;
+  band_rows_ = 256;
+}
+
+void MapExporter::set_band_rows(int band_rows) {
+  band_rows_ = std::max(band_rows, 1);
+}
+
+bool MapExporter::Export(const std::string &base, MapFormat format,
+    const std::function<void(GridMap *band)> &render) const {
+  std::string image = base + (format == MapFormat::kPNG ? ".png" : ".pgm");
+  std::ofstream out(image.c_str(), std::ios::binary);
+  if (!out) {
+    std::cout << "Error: cannot open " << image << std::endl;
+    return false;
+  }
+  std::unique_ptr<ImageWriter> writer;
+  if (format == MapFormat::kPNG) {
+    writer.reset(new PngWriter());
+  } else {
+    writer.reset(new PgmWriter());
+  }
+  if (!writer->Begin(&out, width_, height_)) {
+    std::cout << "Error: cannot write " << image << std::endl;
+    return false;
+  }
+
+  // image rows run from the largest y down, so bands go top first
+  std::vector<uint8_t> row(width_);
+  for (int top = height_; top > 0; top -= band_rows_) {
+    int bottom = std::max(0, top - band_rows_);
+    GridMap band(resolution_,
+        origin_ + Eigen::Vector2d(0.0, bottom * resolution_),
+        width_, top - bottom);
+    render(&band);
+    for (int y = band.height() - 1; y >= 0; y--) {
+      for (int x = 0; x < width_; x++)
+        row[x] = Pixel(band.at(x, y));
+      if (!writer->WriteRow(row)) {
+        std::cout << "Error: cannot write " << image << std::endl;
+        return false;
+      }
+    }
+  }
+  if (!writer->End()) {
+    std::cout << "Error: cannot write " << image << std::endl;
+    return false;
+  }
+  return WriteYaml(base, BaseName(image));
+}
+
+bool MapExporter::WriteYaml(const std::string &base,
+    const std::string &image) const {
+  std::string path = base + ".yaml";
+  std::ofstream yaml(path.c_str());
+  yaml << "image: " << image << "\n"
+    << "resolution: " << resolution_ << "\n"
+    << "origin: [" << origin_.x() << ", " << origin_.y() << ", 0.0]\n"
+    << "negate: 0\n"
+    << "occupied_thresh: " << kOccupiedThresh << "\n"
+    << "free_thresh: " << kFreeThresh << "\n";
+  if (!yaml.good()) {
+    std::cout << "Error: cannot write " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace pgslam
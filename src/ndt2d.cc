@@ -0,0 +1,214 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/ndt2d.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace pgslam {
+
+// points needed for a cell to get a distribution
+const int kMinCellPoints = 3;
+// smallest eigenvalue of a cell covariance relative to the largest
+const double kMinEigenRatio = 0.01;
+// chi-square 95% bound in 2d, a point within it counts as matched
+const double kMatchChi2 = 5.99;
+// step below which a match counts as converged, unless the budget sets one
+const double kMinStep = 0.0001;
+
+NDTGrid::NDTGrid(double resolution) {
+  resolution_ = resolution;
+  width_ = 0;
+  height_ = 0;
+}
+
+double NDTGrid::resolution() const {
+  return resolution_;
+}
+
+size_t NDTGrid::valid_cells() const {
+  size_t count = 0;
+  for (size_t i = 0; i < cells_.size(); i++)
+    if (cells_[i].valid) count++;
+  return count;
+}
+
+int NDTGrid::CellIndex(int x, int y) const {
+  if (x < 0 || x >= width_ || y < 0 || y >= height_)
+    return -1;
+  return y * width_ + x;
+}
+
+void NDTGrid::Construct(const Eigen::Matrix2Xd &points) {
+  cells_.clear();
+  width_ = 0;
+  height_ = 0;
+
+  std::vector<long> finite;
+  for (long i = 0; i < points.cols(); i++)
+    if (points.col(i).allFinite()) finite.push_back(i);
+  if (finite.empty()) return;
+
+  Eigen::Vector2d min = points.col(finite[0]);
+  Eigen::Vector2d max = min;
+  for (size_t i = 0; i < finite.size(); i++) {
+    min = min.cwiseMin(points.col(finite[i]));
+    max = max.cwiseMax(points.col(finite[i]));
+  }
+  origin_ = min;
+  width_  = static_cast<int>((max.x() - min.x()) / resolution_) + 1;
+  height_ = static_cast<int>((max.y() - min.y()) / resolution_) + 1;
+
+  // accumulate first and second moments per cell
+  std::vector<int> count(width_ * height_, 0);
+  std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>>
+    sum(width_ * height_, Eigen::Vector2d::Zero());
+  std::vector<Eigen::Matrix2d, Eigen::aligned_allocator<Eigen::Matrix2d>>
+    sum_sq(width_ * height_, Eigen::Matrix2d::Zero());
+  for (size_t i = 0; i < finite.size(); i++) {
+    Eigen::Vector2d p = points.col(finite[i]);
+    int x = static_cast<int>((p.x() - origin_.x()) / resolution_);
+    int y = static_cast<int>((p.y() - origin_.y()) / resolution_);
+    int index = CellIndex(x, y);
+    count[index]++;
+    sum[index] += p;
+    sum_sq[index] += p * p.transpose();
+  }
+
+  cells_.resize(width_ * height_);
+  for (size_t i = 0; i < cells_.size(); i++) {
+    Cell &cell = cells_[i];
+    cell.valid = false;
+    if (count[i] < kMinCellPoints) continue;
+    cell.mean = sum[i] / count[i];
+    Eigen::Matrix2d cov = (sum_sq[i] - count[i] * cell.mean *
+        cell.mean.transpose()) / (count[i] - 1);
+
+    // inflate thin cells so the inverse stays well conditioned
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix2d> solver(cov);
+    Eigen::Vector2d values = solver.eigenvalues();
+    if (values(1) <= 0) continue;
+    values(0) = std::max(values(0), values(1) * kMinEigenRatio);
+    cell.information = solver.eigenvectors() *
+      values.cwiseInverse().asDiagonal() *
+      solver.eigenvectors().transpose();
+    cell.valid = true;
+  }
+}
+
+double NDTGrid::Evaluate(const Eigen::Matrix2Xd &points,
+    const Eigen::Vector3d &pose, Eigen::Vector3d *gradient,
+    Eigen::Matrix3d *hessian, int *match_count) const {
+  double c = cos(pose(2));
+  double s = sin(pose(2));
+  Eigen::Matrix2d r;
+  r << c, -s,
+       s,  c;
+  Eigen::Vector2d t = pose.head<2>();
+
+  double score = 0.0;
+  if (gradient != nullptr) gradient->setZero();
+  if (hessian != nullptr) hessian->setZero();
+  if (match_count != nullptr) *match_count = 0;
+  for (long i = 0; i < points.cols(); i++) {
+    Eigen::Vector2d p = points.col(i);
+    Eigen::Vector2d q = r * p + t;
+    if (!q.allFinite()) continue;
+
+    // jacobian and the only non-zero second derivative (theta, theta)
+    Eigen::Matrix<double, 2, 3> j;
+    j << 1, 0, -s * p.x() - c * p.y(),
+         0, 1,  c * p.x() - s * p.y();
+    Eigen::Vector2d j_tt(-c * p.x() + s * p.y(), -s * p.x() - c * p.y());
+
+    // the 2x2 block of cells closest to the point
+    double fx = (q.x() - origin_.x()) / resolution_ - 0.5;
+    double fy = (q.y() - origin_.y()) / resolution_ - 0.5;
+    int cx = static_cast<int>(floor(fx));
+    int cy = static_cast<int>(floor(fy));
+    bool matched = false;
+    for (int k = 0; k < 4; k++) {
+      int index = CellIndex(cx + k % 2, cy + k / 2);
+      if (index < 0 || !cells_[index].valid) continue;
+      const Cell &cell = cells_[index];
+      Eigen::Vector2d d = q - cell.mean;
+      Eigen::Vector2d wd = cell.information * d;
+      double mahalanobis = d.dot(wd);
+      if (mahalanobis < kMatchChi2) matched = true;
+      double e = exp(-0.5 * mahalanobis);
+      score -= e;
+
+      // derivatives of -e after biber
+      Eigen::Vector3d dj = j.transpose() * wd;
+      if (gradient != nullptr)
+        *gradient += e * dj;
+      if (hessian != nullptr) {
+        *hessian += e * (-dj * dj.transpose() +
+            j.transpose() * cell.information * j);
+        (*hessian)(2, 2) += e * wd.dot(j_tt);
+      }
+    }
+    if (matched && match_count != nullptr) (*match_count)++;
+  }
+  return score;
+}
+
+MatchResult NDTGrid::Match(const Eigen::Matrix2Xd &points, Pose2D pose,
+    const MatchBudget &budget) const {
+  MatchMonitor monitor(budget, pose, kMinStep);
+  if (cells_.empty() || points.cols() == 0) {
+    monitor.Fail();
+    return monitor.result();
+  }
+
+  Eigen::Vector3d x(pose.x(), pose.y(), pose.theta());
+  while (monitor.Continue()) {
+    Eigen::Vector3d g;
+    Eigen::Matrix3d h;
+    int match_count;
+    double score = Evaluate(points, x, &g, &h, &match_count);
+    if (match_count == 0) {
+      std::cout << "Error: no valid point, return best pose." << std::endl;
+      monitor.Fail();
+      break;
+    }
+    double ratio = static_cast<double>(match_count) / points.cols();
+    // residual in [0, 1], zero when every point sits on a cell mean
+    if (monitor.Record(Pose2D(x(0), x(1), x(2)), ratio,
+          1.0 + score / points.cols()))
+      break;
+
+    // make the hessian positive definite before the newton step
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(h);
+    double min_value = solver.eigenvalues()(0);
+    double max_value = solver.eigenvalues()(2);
+    if (min_value < max_value * 0.001)
+      h += (max_value * 0.001 - min_value) * Eigen::Matrix3d::Identity();
+    Eigen::Vector3d delta = -h.ldlt().solve(g);
+
+    // bound the step to a fraction of a cell
+    double step = delta.head<2>().norm();
+    if (step > resolution_ / 2)
+      delta *= resolution_ / 2 / step;
+    if (fabs(delta(2)) > 0.1)
+      delta *= 0.1 / fabs(delta(2));
+
+    // backtrack until the score decreases
+    int k = 0;
+    for (; k < 10; k++) {
+      if (Evaluate(points, x + delta, nullptr, nullptr, nullptr) < score)
+        break;
+      delta /= 2;
+    }
+    if (k == 10) delta.setZero();
+    x += delta;
+    if (monitor.Step(Pose2D(x(0), x(1), x(2)), delta.head<2>().norm(),
+          delta(2)))
+      break;
+  }
+  return monitor.result();
+}
+
+}  // namespace pgslam
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/nn_search.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace nn_search {
+
+// reference * query pairs below which a linear scan is the cheapest
+const double kBruteForceWork = 1 << 15;
+// cells per gate radius of the grid
+const double kGridCellsPerGate = 8.0;
+// the grid is dropped when it would be much sparser than the cloud
+const double kGridMaxCellsPerPoint = 8.0;
+// more cells are never allocated, a forced grid gets coarser instead
+const double kGridMaxCells = 1 << 24;
+
+template <typename Scalar>
+void BruteForceSearch<Scalar>::Construct(const Points &points) {
+  xs_ = points.row(0).transpose().array();
+  ys_ = points.row(1).transpose().array();
+}
+
+template <typename Scalar>
+size_t BruteForceSearch<Scalar>::NearestIndex(const Point &point) const {
+  if (xs_.size() == 0) return kNoMatch;
+  typename Eigen::Array<Scalar, Eigen::Dynamic, 1>::Index index;
+  ((xs_ - point.x()).square() + (ys_ - point.y()).square()).minCoeff(&index);
+  return index;
+}
+
+template <typename Scalar>
+GridSearch<Scalar>::GridSearch(double gate) {
+  gate_ = gate;
+  cell_ = gate / kGridCellsPerGate;
+  rings_ = static_cast<int>(ceil(kGridCellsPerGate));
+  width_ = 0;
+  height_ = 0;
+}
+
+template <typename Scalar>
+size_t GridSearch<Scalar>::CellCount(const Points &points, double gate) {
+  if (points.cols() == 0) return 0;
+  double cell = gate / kGridCellsPerGate;
+  Point extent = points.rowwise().maxCoeff() - points.rowwise().minCoeff();
+  double cells = (extent.x() / cell + 1) * (extent.y() / cell + 1);
+  if (!(cells < kGridMaxCells)) return static_cast<size_t>(-1);
+  return static_cast<size_t>(cells);
+}
+
+template <typename Scalar>
+void GridSearch<Scalar>::Construct(const Points &points) {
+  width_ = 0;
+  height_ = 0;
+  cell_start_.clear();
+  cell_index_.clear();
+
+  // points without a position can never be the nearest one
+  std::vector<size_t> finite;
+  finite.reserve(points.cols());
+  for (size_t i = 0; i < points.cols(); i++) {
+    if (points.col(i).allFinite()) finite.push_back(i);
+  }
+  if (finite.size() == points.cols()) {
+    points_ = points;
+  } else {
+    points_.resize(Eigen::NoChange, finite.size());
+    for (size_t i = 0; i < finite.size(); i++)
+      points_.col(i) = points.col(finite[i]);
+  }
+  index_.swap(finite);
+  if (points_.cols() == 0) return;
+
+  origin_ = points_.rowwise().minCoeff();
+  Point extent = points_.rowwise().maxCoeff() - origin_;
+  // a sparse cloud chosen by hand still gets a grid of bounded size,
+  // with coarser cells and as many rings as cover the gate
+  cell_ = gate_ / kGridCellsPerGate;
+  double cells = (extent.x() / cell_ + 1) * (extent.y() / cell_ + 1);
+  if (cells > kGridMaxCells)
+    cell_ *= std::sqrt(cells / kGridMaxCells);
+  rings_ = static_cast<int>(std::ceil(gate_ / cell_));
+  width_  = static_cast<int>(extent.x() / cell_) + 1;
+  height_ = static_cast<int>(extent.y() / cell_) + 1;
+
+  // counting sort of the point indices by cell
+  std::vector<size_t> cells_of(points_.cols());
+  cell_start_.assign(static_cast<size_t>(width_) * height_ + 1, 0);
+  for (size_t i = 0; i < points_.cols(); i++) {
+    int cx = static_cast<int>((points_(0, i) - origin_.x()) / cell_);
+    int cy = static_cast<int>((points_(1, i) - origin_.y()) / cell_);
+    cells_of[i] = static_cast<size_t>(cy) * width_ + cx;
+    cell_start_[cells_of[i] + 1]++;
+  }
+  for (size_t i = 1; i < cell_start_.size(); i++)
+    cell_start_[i] += cell_start_[i - 1];
+  std::vector<size_t> fill(cell_start_.begin(), cell_start_.end() - 1);
+  cell_index_.resize(points_.cols());
+  for (size_t i = 0; i < points_.cols(); i++)
+    cell_index_[fill[cells_of[i]]++] = i;
+}
+
+template <typename Scalar>
+size_t GridSearch<Scalar>::NearestIndex(const Point &point) const {
+  if (width_ == 0) return kNoMatch;
+  Scalar fx = (point.x() - origin_.x()) / cell_;
+  Scalar fy = (point.y() - origin_.y()) / cell_;
+  if (!(fx > -rings_ - 1 && fx < width_ + rings_ + 1 &&
+        fy > -rings_ - 1 && fy < height_ + rings_ + 1))
+    return kNoMatch;
+  int cx = static_cast<int>(std::floor(fx));
+  int cy = static_cast<int>(std::floor(fy));
+
+  size_t best = kNoMatch;
+  Scalar best_dist = gate_ * gate_;
+  for (int r = 0; r <= rings_; r++) {
+    for (int y = cy - r; y <= cy + r; y++) {
+      if (y < 0 || y >= height_) continue;
+      // inner rows of the ring only have their two end cells
+      int step = (y == cy - r || y == cy + r) ? 1 : std::max(2 * r, 1);
+      for (int x = cx - r; x <= cx + r; x += step) {
+        if (x < 0 || x >= width_) continue;
+        size_t cell = static_cast<size_t>(y) * width_ + x;
+        for (size_t k = cell_start_[cell]; k < cell_start_[cell + 1]; k++) {
+          size_t index = cell_index_[k];
+          Scalar dist = (points_.col(index) - point).squaredNorm();
+          if (dist < best_dist) {
+            best_dist = dist;
+            best = index;
+          }
+        }
+      }
+    }
+    // nothing beyond this ring can be closer
+    if (best != kNoMatch && best_dist <= r * cell_ * r * cell_)
+      break;
+  }
+  return best == kNoMatch ? kNoMatch : index_[best];
+}
+
+template <typename Scalar>
+void KDTreeSearch<Scalar>::Construct(const Points &points) {
+  tree_.Construct(points);
+}
+
+template <typename Scalar>
+size_t KDTreeSearch<Scalar>::NearestIndex(const Point &point) const {
+  return tree_.NearestIndex(point);
+}
+
+template <typename Scalar>
+ProjectiveSearch<Scalar>::ProjectiveSearch(double angle_min,
+    double angle_increment, size_t interpolate_num, int window) {
+  angle_min_ = angle_min;
+  angle_increment_ = angle_increment;
+  interpolate_num_ = interpolate_num;
+  window_ = window;
+  beams_ = 0;
+  full_circle_ = false;
+}
+
+template <typename Scalar>
+void ProjectiveSearch<Scalar>::Construct(const Points &points) {
+  points_ = points;
+  beams_ = points_.cols() / interpolate_num_;
+  // a full circle scan wraps around, a partial one is clamped
+  full_circle_ = fabs(angle_increment_) * (beams_ + 1) >= 2 * M_PI;
+}
+
+template <typename Scalar>
+size_t ProjectiveSearch<Scalar>::NearestIndex(const Point &point) const {
+  if (beams_ == 0) return kNoMatch;
+  // the bearing in double, beams are too narrow for float angles
+  double bearing = atan2(point.y(), point.x());
+  double offset = bearing - angle_min_;
+  if (angle_increment_ > 0) {
+    while (offset < 0) offset += 2 * M_PI;
+  } else {
+    while (offset > 0) offset -= 2 * M_PI;
+  }
+  double beam_f = offset / angle_increment_;
+  if (!std::isfinite(beam_f))
+    return kNoMatch;
+  long beam = static_cast<long>(beam_f);
+  if (!full_circle_ && beam >= beams_) {
+    // behind the sensor, pick the closer end of the scan
+    beam = (beam_f - beams_ < 2 * M_PI / fabs(angle_increment_) - beam_f) ?
+      beams_ - 1 : 0;
+  }
+
+  size_t best = kNoMatch;
+  Scalar best_dist = std::numeric_limits<Scalar>::max();
+  for (long b = beam - window_; b <= beam + window_; b++) {
+    long k = b;
+    if (full_circle_) {
+      k = ((b % beams_) + beams_) % beams_;
+    } else if (k < 0 || k >= beams_) {
+      continue;
+    }
+    for (size_t j = 0; j < interpolate_num_; j++) {
+      size_t index = interpolate_num_ * k + j;
+      Scalar dist = (points_.col(index) - point).squaredNorm();
+      if (dist < best_dist) {
+        best_dist = dist;
+        best = index;
+      }
+    }
+  }
+  return best;
+}
+
+template <typename Scalar>
+Backend SelectBackend(const Eigen::Matrix<Scalar, 2, Eigen::Dynamic> &reference,
+    size_t query_size, double gate) {
+  if (static_cast<double>(reference.cols()) * query_size <= kBruteForceWork)
+    return Backend::kBruteForce;
+  if (GridSearch<Scalar>::CellCount(reference, gate) <=
+      kGridMaxCellsPerPoint * reference.cols())
+    return Backend::kGrid;
+  return Backend::kKDTree;
+}
+
+template <typename Scalar>
+std::unique_ptr<NearestSearch<Scalar>> Create(Backend backend, double gate) {
+  switch (backend) {
+    case Backend::kBruteForce:
+      return std::unique_ptr<NearestSearch<Scalar>>(
+          new BruteForceSearch<Scalar>());
+    case Backend::kGrid:
+      return std::unique_ptr<NearestSearch<Scalar>>(
+          new GridSearch<Scalar>(gate));
+    default:
+      return std::unique_ptr<NearestSearch<Scalar>>(
+          new KDTreeSearch<Scalar>());
+  }
+}
+
+template class BruteForceSearch<double>;
+template class BruteForceSearch<float>;
+template class GridSearch<double>;
+template class GridSearch<float>;
+template class KDTreeSearch<double>;
+template class KDTreeSearch<float>;
+template class ProjectiveSearch<double>;
+template class ProjectiveSearch<float>;
+template Backend SelectBackend(const Eigen::Matrix2Xd &reference,
+    size_t query_size, double gate);
+template Backend SelectBackend(const Eigen::Matrix2Xf &reference,
+    size_t query_size, double gate);
+template std::unique_ptr<NearestSearch<double>> Create<double>(
+    Backend backend, double gate);
+template std::unique_ptr<NearestSearch<float>> Create<float>(
+    Backend backend, double gate);
+
+}  // namespace nn_search
@@ -2,21 +2,66 @@
  * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
  */
 #include <pgslam/pgslam.h>
-#include <pgslam/kdtree2d.h>
+#include <pgslam/nn_search.h>
+#include <pgslam/icp_engine.h>
+#include <pgslam/ndt2d.h>
+#include <pgslam/submap.h>
+#include <pgslam/hierarchical_graph.h>
+#include <pgslam/scan_store.h>
+#include <pgslam/landmark.h>
 
 #include <float.h>
 #include <sys/time.h>
 #include <Eigen/Eigen>
 
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
 
+using pgslam::Association;
 using pgslam::Pose2D;
 using pgslam::Echo;
+using pgslam::KeyScanPolicy;
 using pgslam::LaserScan;
+using pgslam::LandmarkConfig;
+using pgslam::Lidar;
+using pgslam::Matcher;
+using pgslam::MatchBudget;
+using pgslam::MatchConfig;
+using pgslam::MatchMonitor;
+using pgslam::MatchResult;
+using pgslam::MatchStatus;
+using pgslam::Precision;
+using pgslam::Rejection;
+using pgslam::Solver;
+using pgslam::Prediction;
 using pgslam::GraphSlam;
+using pgslam::HierarchicalGraph;
 using pgslam::Slam;
+using pgslam::SlamConfig;
+using pgslam::SlamSnapshot;
+using pgslam::ThreadPool;
+using pgslam::ScanStore;
+using pgslam::Submap;
+
+// variance across a local line relative to the one along it, for gicp
+const double kLineEpsilon = 0.001;
+// step below which gicp counts as converged, unless the budget sets one
+const double kGICPMinStep = 0.0001;
+
+// stores a cache built on demand by a const method. threads may race to
+// build it, the first one stored is kept and handed to all of them
+template <typename T>
+const T & StoreCache(std::shared_ptr<const T> *cache,
+    std::shared_ptr<const T> built) {
+  std::shared_ptr<const T> stored;
+  if (!std::atomic_compare_exchange_strong(cache, &stored, built))
+    return *stored;
+  return *built;
+}
 
 Pose2D::Pose2D() {
   this->x_ = 0;
@@ -99,25 +144,216 @@ Eigen::Vector2d Echo::point() const {
   return Eigen::Vector2d(x, y);
 }
 
+MatchBudget::MatchBudget() {
+  max_iterations = 100;
+  max_time = 0.0;
+  min_translation = 0.0;
+  min_rotation = 0.0;
+  min_residual_change = 0.0;
+  divergence_ratio = 4.0;
+}
+
+MatchConfig::MatchConfig() {
+  match_threshold = 0.1;
+  dist_threshold = 1.0;
+  interpolation = 7;
+  trim_ratio = 0.1;
+  max_shared = 3;
+  projective_window = 3;
+  covariance_radius = 0.3;
+  ndt_resolution = 0.5;
+  precision = Precision::kDouble;
+  rejection = Rejection::kTrim;
+  solver = Solver::kHeuristic;
+  parallel_points = 1000;
+}
+
+MatchResult::MatchResult() {
+  ratio = 0.0;
+  status = MatchStatus::kConverged;
+  iterations = 0;
+  residual = 0.0;
+}
+
+MatchMonitor::MatchMonitor(const MatchBudget &budget, Pose2D initial,
+                           double min_step) {
+  budget_ = budget;
+  if (budget_.min_translation <= 0)
+    budget_.min_translation = min_step;
+  if (budget_.min_rotation <= 0)
+    budget_.min_rotation = min_step;
+  start_ = std::chrono::steady_clock::now();
+  best_.pose = initial;
+  best_.residual = DBL_MAX;
+  last_ = best_;
+  stopped_ = false;
+}
+
+bool MatchMonitor::Continue() {
+  if (stopped_) return false;
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start_;
+  if (last_.iterations >= budget_.max_iterations ||
+      (budget_.max_time > 0 && elapsed.count() > budget_.max_time)) {
+    last_.status = MatchStatus::kBudgetExhausted;
+    stopped_ = true;
+    return false;
+  }
+  last_.iterations++;
+  return true;
+}
+
+bool MatchMonitor::Record(Pose2D pose, double ratio, double residual) {
+  double previous = last_.residual;
+  last_.pose = pose;
+  last_.ratio = ratio;
+  last_.residual = residual;
+  if (residual < best_.residual)
+    best_ = last_;
+  if (last_.iterations <= 1)
+    return false;
+
+  if (residual > budget_.divergence_ratio * best_.residual) {
+    last_.status = MatchStatus::kDiverged;
+    stopped_ = true;
+  } else if (budget_.min_residual_change > 0 &&
+      fabs(previous - residual) <= budget_.min_residual_change * previous) {
+    last_.status = MatchStatus::kConverged;
+    stopped_ = true;
+  }
+  return stopped_;
+}
+
+bool MatchMonitor::Step(Pose2D pose, double translation, double rotation) {
+  last_.pose = pose;
+  if (translation < budget_.min_translation &&
+      fabs(rotation) < budget_.min_rotation) {
+    last_.status = MatchStatus::kConverged;
+    stopped_ = true;
+  }
+  return stopped_;
+}
+
+void MatchMonitor::Fail() {
+  last_.status = MatchStatus::kDiverged;
+  stopped_ = true;
+}
+
+MatchResult MatchMonitor::result() const {
+  MatchResult result = last_;
+  // anything but convergence falls back to the best evaluated pose
+  if (last_.status != MatchStatus::kConverged)
+    result = best_;
+  if (result.residual == DBL_MAX)
+    result.residual = 0.0;
+  result.status = last_.status;
+  result.iterations = last_.iterations;
+  return result;
+}
+
+Lidar::Lidar() {
+  angle_min = 0.0;
+  angle_increment = 0.0;
+  first = 0;
+  count = 0;
+}
+
+namespace {
+
+// bearings of the beams of one lidar, from its first and last echo. a
+// bearing only finds its point while no beam was left out
+void SetBeams(const std::vector<Echo> &echos, pgslam::Lidar *lidar) {
+  if (echos.size() < 2 || lidar->count < echos.size()) return;
+  lidar->angle_min = echos.front().angle();
+  lidar->angle_increment = (echos.back().angle() - echos.front().angle()) /
+    (echos.size() - 1);
+}
+
+// beams without a return, inf or nan ranges, give no point
+bool Returned(const Echo &echo) {
+  return echo.point().allFinite();
+}
+
+}  // namespace
+
 LaserScan::LaserScan(std::vector<Echo> echos) {
-  points_.resize(Eigen::NoChange, echos.size());
-  for (size_t i = 0; i < echos.size(); i++)
-    points_.col(i) = echos[i].point();
-  world_transformed_flag_ = false;
+  size_t size = std::count_if(echos.begin(), echos.end(), Returned);
+  std::shared_ptr<Eigen::Matrix2Xd> points(new Eigen::Matrix2Xd(2, size));
+  std::shared_ptr<Eigen::VectorXd> intensities(new Eigen::VectorXd(size));
+  size_t count = 0;
+  for (size_t i = 0; i < echos.size(); i++) {
+    if (!Returned(echos[i])) continue;
+    points->col(count) = echos[i].point();
+    (*intensities)(count) = echos[i].intensity();
+    count++;
+  }
+  Lidar lidar;
+  lidar.count = count;
+  SetBeams(echos, &lidar);
+  Init(points, intensities, std::vector<Lidar>(1, lidar),
+      echos.empty() ? 0 : echos.front().time_stamp());
+}
 
-  match_threshold_ = 0.1;
-  dist_threshold_ = 1.0;
+LaserScan::LaserScan(const std::vector<std::vector<Echo>> &echos,
+    const std::vector<Pose2D> &mounts, int64_t time_stamp) {
+  size_t size = 0;
+  for (size_t k = 0; k < echos.size(); k++)
+    size += std::count_if(echos[k].begin(), echos[k].end(), Returned);
+  std::shared_ptr<Eigen::Matrix2Xd> points(new Eigen::Matrix2Xd(2, size));
+  std::shared_ptr<Eigen::VectorXd> intensities(new Eigen::VectorXd(size));
+  std::vector<Lidar> lidars(echos.size());
+  size_t first = 0;
+  for (size_t k = 0; k < echos.size(); k++) {
+    Lidar &lidar = lidars[k];
+    if (k < mounts.size()) lidar.mount = mounts[k];
+    lidar.first = first;
+    auto to_scan = lidar.mount.ToTransform();
+    for (size_t i = 0; i < echos[k].size(); i++) {
+      if (!Returned(echos[k][i])) continue;
+      points->col(first + lidar.count) = to_scan * echos[k][i].point();
+      (*intensities)(first + lidar.count) = echos[k][i].intensity();
+      lidar.count++;
+    }
+    SetBeams(echos[k], &lidar);
+    first += lidar.count;
+  }
+  Init(points, intensities, lidars, time_stamp);
 }
 
-LaserScan::LaserScan(std::vector<Echo> echos, Pose2D pose) {
-  points_.resize(Eigen::NoChange, echos.size());
-  for (size_t i = 0; i < echos.size(); i++)
-    points_.col(i) = echos[i].point();
-  pose_ = pose;
+void LaserScan::Init(std::shared_ptr<const Eigen::Matrix2Xd> points,
+    std::shared_ptr<const Eigen::VectorXd> intensities,
+    const std::vector<Lidar> &lidars, int64_t time_stamp) {
+  points_ = points;
+  points_world_ = std::make_shared<const Eigen::Matrix2Xd>();
+  intensities_ = intensities;
+  lidars_ = std::make_shared<const std::vector<Lidar>>(lidars);
+  time_stamp_ = time_stamp;
   world_transformed_flag_ = false;
+  local_min_ = Eigen::Vector2d::Zero();
+  local_max_ = Eigen::Vector2d::Zero();
+  if (points_->cols() > 0) {
+    local_min_ = points_->rowwise().minCoeff();
+    local_max_ = points_->rowwise().maxCoeff();
+  }
+  resident_ = true;
+
+  // a bearing only finds its beam while the points are in the frame of
+  // their one lidar
+  angle_min_ = 0.0;
+  angle_increment_ = 0.0;
+  if (lidars.size() == 1 && lidars[0].mount.x() == 0.0 &&
+      lidars[0].mount.y() == 0.0 && lidars[0].mount.theta() == 0.0) {
+    angle_min_ = lidars[0].angle_min;
+    angle_increment_ = lidars[0].angle_increment;
+  }
+  association_ = Association::kAuto;
+  matcher_ = Matcher::kICP;
+  pool_ = NULL;
+}
 
-  match_threshold_ = 0.1;
-  dist_threshold_ = 1.0;
+LaserScan::LaserScan(std::vector<Echo> echos, Pose2D pose)
+  : LaserScan(echos) {
+  pose_ = pose;
 }
 
 Pose2D LaserScan::pose() const {
@@ -129,15 +365,99 @@ void LaserScan::set_pose(Pose2D pose) {
   world_transformed_flag_ = false;
 }
 
+int64_t LaserScan::time_stamp() const {
+  return time_stamp_;
+}
+
+Association LaserScan::association() const {
+  return association_;
+}
+
+void LaserScan::set_association(Association association) {
+  association_ = association;
+}
+
+void LaserScan::set_projective_window(int projective_window) {
+  match_config_.projective_window = projective_window;
+}
+
+const MatchConfig & LaserScan::match_config() const {
+  return match_config_;
+}
+
+void LaserScan::set_match_config(const MatchConfig &config) {
+  // what is cached on demand follows the new thresholds
+  if (config.covariance_radius != match_config_.covariance_radius)
+    std::atomic_store(&covariances_,
+        std::shared_ptr<const pgslam::Covariances>());
+  if (config.ndt_resolution != match_config_.ndt_resolution)
+    std::atomic_store(&ndt_grid_, std::shared_ptr<const pgslam::NDTGrid>());
+  if (config.interpolation != match_config_.interpolation)
+    std::atomic_store(&float_reference_,
+        std::shared_ptr<const Eigen::Matrix2Xf>());
+  match_config_ = config;
+}
+
+Matcher LaserScan::matcher() const {
+  return matcher_;
+}
+
+void LaserScan::set_thread_pool(ThreadPool *pool) {
+  pool_ = pool;
+}
+
+void LaserScan::set_matcher(Matcher matcher) {
+  matcher_ = matcher;
+}
+
 const Eigen::Matrix2Xd& LaserScan::points() {
   UpdateToWorld();
-  return points_world_;
+  return *points_world_;
+}
+
+const Eigen::Matrix2Xd& LaserScan::local_points() const {
+  return *points_;
+}
+
+const Eigen::VectorXd& LaserScan::intensities() const {
+  return *intensities_;
+}
+
+const std::vector<Lidar> & LaserScan::lidars() const {
+  return *lidars_;
+}
+
+bool LaserScan::resident() const {
+  return resident_;
+}
+
+void LaserScan::Release() {
+  if (!resident_) return;
+  points_ = std::make_shared<const Eigen::Matrix2Xd>();
+  points_world_ = points_;
+  // the caches are only ever accessed atomically
+  std::atomic_store(&covariances_,
+      std::shared_ptr<const pgslam::Covariances>());
+  std::atomic_store(&ndt_grid_, std::shared_ptr<const pgslam::NDTGrid>());
+  std::atomic_store(&float_points_, std::shared_ptr<const Eigen::Matrix2Xf>());
+  std::atomic_store(&float_reference_,
+      std::shared_ptr<const Eigen::Matrix2Xf>());
+  resident_ = false;
+  world_transformed_flag_ = false;
+}
+
+void LaserScan::Restore(const Eigen::Matrix2Xd &points) {
+  points_ = std::make_shared<const Eigen::Matrix2Xd>(points);
+  resident_ = true;
+  world_transformed_flag_ = false;
 }
 
 void LaserScan::UpdateToWorld() {
   if (world_transformed_flag_) return;
 
-  points_world_.resize(Eigen::NoChange, points_.cols());
+  // a fresh matrix, copies of this scan may still share the old one
+  std::shared_ptr<Eigen::Matrix2Xd> points_world(
+      new Eigen::Matrix2Xd(2, points_->cols()));
 
   max_x_ = 0.0;
   min_x_ = 0.0;
@@ -145,155 +465,289 @@ void LaserScan::UpdateToWorld() {
   min_y_ = 0.0;
 
   auto t = pose_.ToTransform();
-  for (size_t i = 0; i < points_.cols(); i++) {
-    Eigen::Vector2d p = t * points_.col(i);
-    points_world_.col(i) = p;
+  for (size_t i = 0; i < points_->cols(); i++) {
+    Eigen::Vector2d p = t * points_->col(i);
+    points_world->col(i) = p;
+    if (p.x() > max_x_) max_x_ = p.x();
+    if (p.x() < min_x_) min_x_ = p.x();
+    if (p.y() > max_y_) max_y_ = p.y();
+    if (p.y() < min_y_) min_y_ = p.y();
+  }
+
+  // paged out, the corners of the local box bound the points
+  for (int i = 0; !resident_ && i < 4; i++) {
+    Eigen::Vector2d corner((i & 1) ? local_max_.x() : local_min_.x(),
+        (i & 2) ? local_max_.y() : local_min_.y());
+    Eigen::Vector2d p = t * corner;
     if (p.x() > max_x_) max_x_ = p.x();
     if (p.x() < min_x_) min_x_ = p.x();
     if (p.y() > max_y_) max_y_ = p.y();
     if (p.y() < min_y_) min_y_ = p.y();
   }
 
+  points_world_ = points_world;
   world_transformed_flag_ = true;
 }
 
-Pose2D LaserScan::ICP(const LaserScan &scan, double *ratio) {
-  Pose2D reference_pose = scan.pose() * pose_.inverse();
-
-  // interpolate
-  size_t interpolate_num = 7;
-  Eigen::Matrix2Xd points_ref;
-  points_ref.resize(Eigen::NoChange, points_.cols() * interpolate_num);
-  for (size_t i = 0; i < points_.cols() - 1; i++) {
+template <typename Scalar>
+Eigen::Matrix<Scalar, 2, Eigen::Dynamic> LaserScan::Interpolate(
+    size_t interpolate_num) const {
+  Eigen::Matrix<Scalar, 2, Eigen::Dynamic> points_ref;
+  points_ref.resize(Eigen::NoChange, points_->cols() * interpolate_num);
+  if (points_->cols() == 0) return points_ref;
+  for (size_t i = 0; i < points_->cols() - 1; i++) {
     for (size_t j = 0; j < interpolate_num; j++) {
-      Eigen::Vector2d curr = points_.col(i + 0);
-      Eigen::Vector2d next = points_.col(i + 1);
+      Eigen::Vector2d curr = points_->col(i + 0);
+      Eigen::Vector2d next = points_->col(i + 1);
       double gain = static_cast<double>(j) / interpolate_num;
-      points_ref.col(interpolate_num * i + j) = (next - curr) * gain + curr;
+      points_ref.col(interpolate_num * i + j) =
+        ((next - curr) * gain + curr).cast<Scalar>();
     }
   }
+  for (size_t j = 0; j < interpolate_num; j++)
+    points_ref.col(interpolate_num * (points_->cols() - 1) + j) =
+      points_->col(points_->cols() - 1).cast<Scalar>();
+  return points_ref;
+}
 
-  // construct kd tree
-  kd_tree_2d::KDTree2D tree;
-  tree.Construct(points_ref);
+template <typename Scalar>
+std::unique_ptr<nn_search::NearestSearch<Scalar>> LaserScan::CreateSearch(
+    const Eigen::Matrix<Scalar, 2, Eigen::Dynamic> &reference,
+    size_t interpolate_num, size_t query_size) const {
+  std::unique_ptr<nn_search::NearestSearch<Scalar>> search;
+  if (association_ == Association::kProjective && angle_increment_ != 0.0) {
+    search.reset(new nn_search::ProjectiveSearch<Scalar>(angle_min_,
+          angle_increment_, interpolate_num,
+          match_config_.projective_window));
+  } else {
+    nn_search::Backend backend = nn_search::Backend::kKDTree;
+    if (association_ == Association::kBruteForce) {
+      backend = nn_search::Backend::kBruteForce;
+    } else if (association_ == Association::kGrid) {
+      backend = nn_search::Backend::kGrid;
+    } else if (association_ != Association::kKDTree) {
+      backend = nn_search::SelectBackend(reference, query_size,
+          match_config_.dist_threshold);
+    }
+    search = nn_search::Create<Scalar>(backend,
+        match_config_.dist_threshold);
+  }
+  search->Construct(reference);
+  return search;
+}
 
-  // iterate
-  Pose2D pose = reference_pose;
-  for (int i = 0; i < 100; i++) {
-    Eigen::Matrix2Xd points = pose.ToTransform() * scan.points_;
+Pose2D LaserScan::Match(const LaserScan &scan, double *ratio) {
+  MatchResult result = Match(scan, MatchBudget());
+  if (ratio != nullptr)
+    *ratio = result.ratio;
+  return result.pose;
+}
 
-    // store the closest point
-    Eigen::Matrix2Xd near = points;
-    // to trace some points have a same closest point
-    std::vector<std::vector<int>> trace_back(points_ref.cols());
-    // true: effective point; false: non-effective point;
-    std::vector<bool> mask(points.cols());
+MatchResult LaserScan::Match(const LaserScan &scan,
+    const MatchBudget &budget) {
+  switch (matcher_) {
+    case Matcher::kGICP:
+      return GICP(scan, budget);
+    case Matcher::kNDT:
+      return NDT(scan, budget);
+    default:
+      return ICP(scan, budget);
+  }
+}
 
-    // search and save nearest point
-    int match_count = 0;
-    for (size_t i = 0; i < points.cols(); i++) {
-      Eigen::Vector2d point = points.col(i);
+Pose2D LaserScan::ICP(const LaserScan &scan, double *ratio) {
+  MatchResult result = ICP(scan, MatchBudget());
+  if (ratio != nullptr)
+    *ratio = result.ratio;
+  return result.pose;
+}
 
-      size_t index = tree.NearestIndex(points.col(i));
+MatchResult LaserScan::ICP(const LaserScan &scan, const MatchBudget &budget) {
+  // the float clouds are cached, key scans are matched over and over
+  if (match_config_.precision == Precision::kFloat)
+    return ICPKernel<float>(float_reference(), scan.float_points(), scan,
+        budget);
+  return ICPKernel<double>(
+      Interpolate<double>(std::max(match_config_.interpolation, 1)),
+      *scan.points_, scan, budget);
+}
 
-      trace_back[index].push_back(i);
-      Eigen::Vector2d closest = points_ref.col(index);
+// the points are in Scalar, while the pose is accumulated in double
+template <typename Scalar>
+MatchResult LaserScan::ICPKernel(
+    const Eigen::Matrix<Scalar, 2, Eigen::Dynamic> &reference,
+    const Eigen::Matrix<Scalar, 2, Eigen::Dynamic> &query,
+    const LaserScan &scan, const MatchBudget &budget) {
+  size_t interpolate_num = std::max(match_config_.interpolation, 1);
+  pgslam::icp::Geometry geometry = {angle_min_, angle_increment_,
+    interpolate_num, pool_};
+  return pgslam::icp::Match<Scalar>(association_, match_config_, geometry,
+      reference, query, scan.pose() * pose_.inverse(), budget);
+}
 
-      double distance = (point - closest).norm();
-      if (distance < match_threshold_)
-        match_count++;
-      if (distance < dist_threshold_) {
-        near.col(i) = closest;
-        mask[i] = true;
-      } else {
-        mask[i] = false;
-      }
-    }
-    if (ratio != nullptr)
-      *ratio = static_cast<double>(match_count) / points.cols();
-
-    // disable the points have one same nearest point
-    for (size_t i = 0; i < trace_back.size(); i++)
-      if (trace_back[i].size() > 3) {
-        for (size_t j = 0; j < trace_back[i].size(); j++) {
-          mask[trace_back[i][j]] = false;
-          near.col(trace_back[i][j]) = points.col(trace_back[i][j]);
-        }
-      }
+const Eigen::Matrix2Xf & LaserScan::float_points() const {
+  std::shared_ptr<const Eigen::Matrix2Xf> cached =
+    std::atomic_load(&float_points_);
+  if (cached) return *cached;
+  return StoreCache<Eigen::Matrix2Xf>(&float_points_,
+      std::make_shared<const Eigen::Matrix2Xf>(points_->cast<float>()));
+}
 
-    // disable the farest 10% point
-    std::vector<double> max_distance;
-    std::vector<int>    max_index;
-    max_distance.resize(points.cols() / 10, 0.0);
-    max_index.resize(points.cols() / 10, 0);
-    for (size_t i = 0; i < points.cols(); i++) {
-      double distance = (points.col(i) - near.col(i)).norm();
-      for (size_t j = 1; j < max_distance.size(); j++) {
-        if (distance > max_distance[j]) {
-          max_distance[j-1] = max_distance[j];
-          max_index[j-1] = max_index[j];
-          if (j == max_distance.size()-1) {
-            max_distance[j] = distance;
-            max_index[j] = i;
-          }
-        } else {
-          max_distance[j-1] = distance;
-          max_index[j-1] = i;
-          break;
-        }
-      }
+const Eigen::Matrix2Xf & LaserScan::float_reference() const {
+  std::shared_ptr<const Eigen::Matrix2Xf> cached =
+    std::atomic_load(&float_reference_);
+  if (cached) return *cached;
+  return StoreCache<Eigen::Matrix2Xf>(&float_reference_,
+      std::make_shared<const Eigen::Matrix2Xf>(
+        Interpolate<float>(std::max(match_config_.interpolation, 1))));
+}
+
+const pgslam::Covariances & LaserScan::covariances() const {
+  std::shared_ptr<const pgslam::Covariances> cached =
+    std::atomic_load(&covariances_);
+  if (cached) return *cached;
+
+  // neighbours are taken along the beam order, closer than the radius
+  const int neighbours = 3;
+  const double radius = match_config_.covariance_radius;
+
+  std::shared_ptr<pgslam::Covariances> covariances(
+      new pgslam::Covariances(points_->cols()));
+  for (long i = 0; i < points_->cols(); i++) {
+    Eigen::Vector2d center(0.0, 0.0);
+    std::vector<long> near;
+    for (long j = i - neighbours; j <= i + neighbours; j++) {
+      if (j < 0 || j >= points_->cols()) continue;
+      if ((points_->col(j) - points_->col(i)).norm() > radius) continue;
+      near.push_back(j);
+      center += points_->col(j);
     }
-    for (size_t i = 1; i < max_index.size(); i++)
-      mask[max_index[i]] = false;
+    // exactly the identity, gicp tells these apart from fitted lines
+    if (near.size() < 3) {
+      (*covariances)[i] = Eigen::Matrix2d::Identity();
+      continue;
+    }
+    center /= near.size();
+    Eigen::Matrix2d cov = Eigen::Matrix2d::Zero();
+    for (size_t k = 0; k < near.size(); k++) {
+      Eigen::Vector2d d = points_->col(near[k]) - center;
+      cov += d * d.transpose();
+    }
+    // flatten to a line: unit variance along it, epsilon across it
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix2d> solver(cov);
+    Eigen::Vector2d normal = solver.eigenvectors().col(0);
+    Eigen::Vector2d tangent = solver.eigenvectors().col(1);
+    (*covariances)[i] = tangent * tangent.transpose() +
+      kLineEpsilon * normal * normal.transpose();
+  }
+  return StoreCache<pgslam::Covariances>(&covariances_, covariances);
+}
+
+Pose2D LaserScan::GICP(const LaserScan &scan, double *ratio) {
+  MatchResult result = GICP(scan, MatchBudget());
+  if (ratio != nullptr)
+    *ratio = result.ratio;
+  return result.pose;
+}
+
+MatchResult LaserScan::GICP(const LaserScan &scan,
+    const MatchBudget &budget) {
+  Pose2D reference_pose = scan.pose() * pose_.inverse();
+  MatchMonitor monitor(budget, reference_pose, kGICPMinStep);
+  if (points_->cols() == 0 || scan.points_->cols() == 0) {
+    monitor.Fail();
+    return monitor.result();
+  }
 
-    // calc center
-    Eigen::Vector2d center(0, 0);
+  const Covariances & reference_cov = covariances();
+  const Covariances & source_cov = scan.covariances();
+  auto search = CreateSearch(*points_, 1, scan.points_->cols());
+
+  double x = reference_pose.x();
+  double y = reference_pose.y();
+  double theta = reference_pose.theta();
+  while (monitor.Continue()) {
+    Eigen::Rotation2D<double> rot(theta);
+    Eigen::Matrix2d r = rot.toRotationMatrix();
+    Eigen::Vector2d t(x, y);
+
+    Eigen::Matrix3d h = Eigen::Matrix3d::Zero();
+    Eigen::Vector3d b = Eigen::Vector3d::Zero();
+    double residual = 0.0;
     int count = 0;
-    for (size_t i = 0; i < points.cols(); i++)
-      if (mask[i]) {
-        center += points.col(i);
-        count++;
-      }
-    if (count == 0) {
-      std::cout << "Error: no valid point, return reference pose." << std::endl;
-      if (ratio != nullptr)
-        *ratio = 0.0;
-      return reference_pose;
-    }
-    center /= count;
-
-    // calc the tramsform
-    Eigen::Vector2d move = Eigen::Vector2d(0.0, 0.0);
-    double rot = 0.0;
-    for (size_t i = 0; i < points.cols(); i++) {
-      if (mask[i] == false) continue;
-      Eigen::Vector2d delta = near.col(i) - points.col(i);
-      double length = delta.norm();
-      if (length > 0) {
-        delta.normalize();
-        delta *= (length < 0.05) ? length : sqrt(length * 20) / 20;
-      }
-      move += delta;
-      Eigen::Vector2d p = points.col(i) - center;
-      Eigen::Vector2d q = near.col(i) - center;
-      if (p.norm() < DBL_EPSILON * 2) continue;
+    int match_count = 0;
+    for (long i = 0; i < scan.points_->cols(); i++) {
+      Eigen::Vector2d p = r * scan.points_->col(i);
+      Eigen::Vector2d q = p + t;
+      size_t index = search->NearestIndex(q);
+      if (index == nn_search::kNoMatch) continue;
+      Eigen::Vector2d d = points_->col(index) - q;
+      if (!(d.norm() < match_config_.dist_threshold)) continue;
+
+      // combined covariance of both distributions
+      Eigen::Matrix2d c = reference_cov[index] +
+        r * source_cov[i] * r.transpose();
+      Eigen::Matrix2d w = c.inverse();
+      // roughly the point to line distance where a line was fitted, the
+      // plain distance to a point with too few neighbours for one
+      const Eigen::Matrix2d &line = reference_cov[index];
+      double threshold =
+        match_config_.match_threshold * match_config_.match_threshold;
+      if (line == Eigen::Matrix2d::Identity() ?
+          d.squaredNorm() < threshold :
+          d.dot(line.inverse() * d) * kLineEpsilon < threshold)
+        match_count++;
 
-      rot += (p.x() * q.y() - p.y() * q.x()) / p.norm() / sqrt(p.norm());
+      // d(q)/d(x, y, theta)
+      Eigen::Matrix<double, 2, 3> j;
+      j << 1, 0, -p.y(),
+           0, 1,  p.x();
+      h += j.transpose() * w * j;
+      b += j.transpose() * w * d;
+      residual += d.dot(w * d);
+      count++;
     }
-    move /= count;
-    rot /= count;
-
-    // speed up
-    move *= 2.0;
-    rot *= 1.0;
+    if (count < 3) {
+      std::cout << "Error: no valid point, return best pose." << std::endl;
+      monitor.Fail();
+      break;
+    }
+    double ratio = static_cast<double>(match_count) / scan.points_->cols();
+    if (monitor.Record(Pose2D(x, y, theta), ratio, residual / count))
+      break;
 
-    // update pose
-    Pose2D pose_delta = pose * Pose2D(move.x(), move.y(), rot) * pose.inverse();
-    pose = pose_delta * pose;
-    if (pose_delta.pos().norm() < 0.001 && pose_delta.theta() < 0.001)
+    // gauss newton step, slightly damped for corridor like degeneracy
+    h.diagonal() *= 1.001;
+    Eigen::Vector3d delta = h.ldlt().solve(b);
+    x += delta(0);
+    y += delta(1);
+    theta += delta(2);
+    if (monitor.Step(Pose2D(x, y, theta), delta.head<2>().norm(), delta(2)))
       break;
   }
-  return pose;
+  return monitor.result();
+}
+
+const pgslam::NDTGrid & LaserScan::ndt_grid() const {
+  std::shared_ptr<const pgslam::NDTGrid> cached = std::atomic_load(&ndt_grid_);
+  if (cached) return *cached;
+  std::shared_ptr<pgslam::NDTGrid> grid(
+      new pgslam::NDTGrid(match_config_.ndt_resolution));
+  // the raw points, interpolation would smear cells across depth jumps
+  grid->Construct(*points_);
+  return StoreCache<pgslam::NDTGrid>(&ndt_grid_, grid);
+}
+
+Pose2D LaserScan::NDT(const LaserScan &scan, double *ratio) {
+  MatchResult result = NDT(scan, MatchBudget());
+  if (ratio != nullptr)
+    *ratio = result.ratio;
+  return result.pose;
+}
+
+MatchResult LaserScan::NDT(const LaserScan &scan, const MatchBudget &budget) {
+  Pose2D reference_pose = scan.pose() * pose_.inverse();
+  return ndt_grid().Match(*scan.points_, reference_pose, budget);
 }
 
 double LaserScan::max_x_in_world() {
@@ -321,6 +775,16 @@ GraphSlam::GraphSlam() {
   slam_ = new isam::Slam();
 }
 
+void GraphSlam::set_cluster_size(size_t cluster_size) {
+  // nodes cannot move between the flat and the clustered graph
+  if (!pose_nodes_.empty() || (hierarchy_ && !hierarchy_->nodes().empty()))
+    return;
+  if (cluster_size > 0)
+    hierarchy_ = std::make_shared<HierarchicalGraph>(cluster_size);
+  else
+    hierarchy_.reset();
+}
+
 bool GraphSlam::check(size_t id) {
   // size enough
   if (id < pose_nodes_.size()) {
@@ -341,6 +805,10 @@ bool GraphSlam::check(size_t id) {
 }
 
 void GraphSlam::remove(size_t node_id) {
+  if (hierarchy_) {
+    hierarchy_->remove(node_id);
+    return;
+  }
   slam_->remove_node(pose_nodes_[node_id]);
   delete pose_nodes_[node_id];
   pose_nodes_[node_id] = NULL;
@@ -351,9 +819,16 @@ void GraphSlam::clear() {
   delete slam_;
   slam_ = new isam::Slam();
   std::vector<isam::Pose2d_Node*>().swap(pose_nodes_);
+  edges_.clear();
+  std::vector<isam::Point2d_Node*>().swap(landmark_nodes_);
+  landmark_edges_.clear();
+  if (hierarchy_)
+    hierarchy_ = std::make_shared<HierarchicalGraph>(
+        hierarchy_->cluster_size());
 }
 
 std::vector<std::pair<size_t, Pose2D>> GraphSlam::nodes() {
+  if (hierarchy_) return hierarchy_->nodes();
   std::vector<std::pair<size_t, Pose2D>> pose_id;
   // store in response
   for (size_t i = 0; i < pose_nodes_.size(); i++) {
@@ -368,24 +843,50 @@ std::vector<std::pair<size_t, Pose2D>> GraphSlam::nodes() {
 }
 
 std::vector<std::pair<Eigen::Vector2d, Eigen::Vector2d>> GraphSlam::factors() {
+  if (hierarchy_) return hierarchy_->factors();
   std::vector<std::pair<Eigen::Vector2d, Eigen::Vector2d>> factors;
-  const std::list<isam::Factor*> factors_ = slam_->get_factors();
-  for (std::list<isam::Factor*>::const_iterator it = factors_.begin();
-      it != factors_.end(); it++) {
-    std::vector<isam::Node*> nodes = (*it)->nodes();
-    if (nodes.size() == 1) continue;
-    Eigen::Vector2d first;
-    first.x() = ((isam::Pose2d_Node*)nodes[0])->value().x();
-    first.y() = ((isam::Pose2d_Node*)nodes[0])->value().y();
-    Eigen::Vector2d second;
-    second.x() = ((isam::Pose2d_Node*)nodes[1])->value().x();
-    second.y() = ((isam::Pose2d_Node*)nodes[1])->value().y();
+  for (size_t i = 0; i < edges_.size(); i++) {
+    isam::Pose2d_Node *ref = pose_nodes_[edges_[i].first];
+    isam::Pose2d_Node *node = pose_nodes_[edges_[i].second];
+    if (ref == NULL || node == NULL) continue;  // removed
+    Eigen::Vector2d first(ref->value().x(), ref->value().y());
+    Eigen::Vector2d second(node->value().x(), node->value().y());
+    factors.push_back(std::make_pair(first, second));
+  }
+  for (size_t i = 0; i < landmark_edges_.size(); i++) {
+    isam::Pose2d_Node *node = pose_nodes_[landmark_edges_[i].first];
+    isam::Point2d_Node *landmark = landmark_nodes_[landmark_edges_[i].second];
+    if (node == NULL) continue;  // removed
+    Eigen::Vector2d first(node->value().x(), node->value().y());
+    Eigen::Vector2d second(landmark->value().x(), landmark->value().y());
     factors.push_back(std::make_pair(first, second));
   }
   return factors;
 }
 
+const std::vector<std::pair<size_t, size_t>> & GraphSlam::edges() const {
+  return edges_;
+}
+
+std::vector<Eigen::Vector2d> GraphSlam::landmarks() {
+  std::vector<Eigen::Vector2d> landmarks(landmark_nodes_.size());
+  for (size_t i = 0; i < landmark_nodes_.size(); i++) {
+    landmarks[i].x() = landmark_nodes_[i]->value().x();
+    landmarks[i].y() = landmark_nodes_[i]->value().y();
+  }
+  return landmarks;
+}
+
+const std::vector<std::pair<size_t, size_t>> &
+GraphSlam::landmark_edges() const {
+  return landmark_edges_;
+}
+
 void GraphSlam::AddPose2dFactor(size_t node_id, Pose2D pose_ros, double cov) {
+  if (hierarchy_) {
+    hierarchy_->AddPose2dFactor(node_id, pose_ros, cov);
+    return;
+  }
   isam::Pose2d pose(pose_ros.x(), pose_ros.y(), pose_ros.theta());
   if (cov <= 0) {
     cov = 1.0;
@@ -405,6 +906,11 @@ void GraphSlam::AddPose2dFactor(size_t node_id, Pose2D pose_ros, double cov) {
 
 void GraphSlam::AddPose2dPose2dFactor(size_t node_id_ref,
     size_t node_id, Pose2D pose_ros, double cov) {
+  edges_.push_back(std::make_pair(node_id_ref, node_id));
+  if (hierarchy_) {
+    hierarchy_->AddPose2dPose2dFactor(node_id_ref, node_id, pose_ros, cov);
+    return;
+  }
   isam::Pose2d pose(pose_ros.x(), pose_ros.y(), pose_ros.theta());
   if (cov <= 0) {
     cov = 1.0;
@@ -425,26 +931,178 @@ void GraphSlam::AddPose2dPose2dFactor(size_t node_id_ref,
   // slam_->batch_optimization();
 }
 
+void GraphSlam::AddPose2dPoint2dFactor(size_t node_id, size_t landmark_id,
+    Eigen::Vector2d measurement, double cov) {
+  // clusters are reduced to their poses, they have no room for landmarks
+  if (hierarchy_ || landmark_id > landmark_nodes_.size()) return;
+  if (cov <= 0) {
+    cov = 1.0;
+  }
+
+  // check new node
+  bool ret = check(node_id);
+  if (ret) slam_->add_node(pose_nodes_[node_id]);
+  if (landmark_id == landmark_nodes_.size()) {
+    landmark_nodes_.push_back(new isam::Point2d_Node());
+    slam_->add_node(landmark_nodes_.back());
+  }
+  landmark_edges_.push_back(std::make_pair(node_id, landmark_id));
+
+  // add factor, a new landmark starts where it is seen from the node
+  isam::Point2d point(measurement.x(), measurement.y());
+  isam::Noise noise = isam::Information(cov * isam::eye(2));
+  isam::Pose2d_Point2d_Factor * factor =
+    new isam::Pose2d_Point2d_Factor(pose_nodes_[node_id],
+        landmark_nodes_[landmark_id], point, noise);
+  slam_->add_factor(factor);
+}
+
 void GraphSlam::Optimization() {
+  if (hierarchy_) {
+    hierarchy_->Optimization();
+    return;
+  }
   slam_->batch_optimization();
 }
 #endif
 
+SlamSnapshot::SlamSnapshot() {
+  version = 0;
+  map_version = 0;
+  time_stamp = 0;
+}
+
+LaserScan SlamSnapshot::scan(size_t scan_id) const {
+  LaserScan scan = *(*scans)[scan_id];
+  Eigen::Matrix2Xd points;
+  if (!scan.resident() && store && store->Load(scan_id, &points))
+    scan.Restore(points);
+  return scan;
+}
+
+SlamConfig::SlamConfig() {
+  keyscan_threshold = 0.4;
+  factor_threshold = 0.9;
+  keyscan_policy = KeyScanPolicy::kDistance;
+  keyscan_overlap = 0.6;
+  keyscan_hysteresis = 3;
+  association = Association::kAuto;
+  matcher = Matcher::kICP;
+  prediction = Prediction::kOdometry;
+  prediction_blend = 0.5;
+}
+
+LandmarkConfig::LandmarkConfig() {
+  intensity = 0.0;
+  min_points = 2;
+  max_size = 0.15;
+  gate = 0.5;
+  weight = 1.0;
+}
+
 Slam::Slam() {
-  keyscan_threshold_ = 0.4;
-  factor_threshold_ = 0.9;
+  low_overlap_count_ = 0;
+  submap_size_ = 0;
+  pool_ = NULL;
+  version_ = 0;
+  map_version_ = 0;
+  Publish(true);
 }
 
 void Slam::set_keyscan_threshold(double keyscan_threshold) {
-  this->keyscan_threshold_ = keyscan_threshold;
-  if (keyscan_threshold_ * 2 > factor_threshold_)
-    factor_threshold_ = keyscan_threshold_ * 2;
+  config_.keyscan_threshold = keyscan_threshold;
+  if (config_.keyscan_threshold * 2 > config_.factor_threshold)
+    config_.factor_threshold = config_.keyscan_threshold * 2;
 }
 
 void Slam::set_factor_threshold(double factor_threshold) {
-  this->factor_threshold_ = factor_threshold;
-  if (keyscan_threshold_ * 2 > factor_threshold_)
-    keyscan_threshold_ = factor_threshold_/2;
+  config_.factor_threshold = factor_threshold;
+  if (config_.keyscan_threshold * 2 > config_.factor_threshold)
+    config_.keyscan_threshold = config_.factor_threshold / 2;
+}
+
+void Slam::set_keyscan_policy(KeyScanPolicy policy) {
+  config_.keyscan_policy = policy;
+  low_overlap_count_ = 0;
+}
+
+void Slam::set_keyscan_overlap(double overlap) {
+  config_.keyscan_overlap = overlap;
+}
+
+void Slam::set_keyscan_hysteresis(int hysteresis) {
+  config_.keyscan_hysteresis = hysteresis;
+}
+
+void Slam::set_submap_size(size_t submap_size) {
+  // the graph cannot change its node meaning once it has nodes
+  if (!scans_.empty()) return;
+  submap_size_ = submap_size;
+}
+
+void Slam::set_graph_cluster_size(size_t cluster_size) {
+  if (!scans_.empty()) return;
+#ifdef USE_ISAM
+  graph_slam_.set_cluster_size(cluster_size);
+#endif
+}
+
+void Slam::set_scan_store(std::shared_ptr<ScanStore> store) {
+  if (!scans_.empty()) return;
+  store_ = store;
+}
+
+void Slam::set_thread_pool(ThreadPool *pool) {
+  pool_ = pool;
+  for (size_t i = 0; i < scans_.size(); i++)
+    scans_[i].set_thread_pool(pool);
+}
+
+void Slam::set_association(Association association) {
+  config_.association = association;
+  for (size_t i = 0; i < scans_.size(); i++)
+    scans_[i].set_association(association);
+}
+
+void Slam::set_matcher(Matcher matcher) {
+  config_.matcher = matcher;
+  for (size_t i = 0; i < scans_.size(); i++)
+    scans_[i].set_matcher(matcher);
+}
+
+void Slam::set_tracking_budget(const MatchBudget &budget) {
+  config_.tracking_budget = budget;
+}
+
+void Slam::set_factor_budget(const MatchBudget &budget) {
+  config_.factor_budget = budget;
+}
+
+void Slam::set_prediction(Prediction prediction) {
+  config_.prediction = prediction;
+}
+
+void Slam::set_prediction_blend(double blend) {
+  config_.prediction_blend = blend;
+}
+
+const SlamConfig & Slam::config() const {
+  return config_;
+}
+
+void Slam::set_config(const SlamConfig &config) {
+  // key scans keep their cached reference data unless it changes
+  if (config.association != config_.association)
+    set_association(config.association);
+  if (config.matcher != config_.matcher)
+    set_matcher(config.matcher);
+  for (size_t i = 0; i < scans_.size(); i++)
+    scans_[i].set_match_config(config.match);
+  if (config.keyscan_policy != config_.keyscan_policy)
+    set_keyscan_policy(config.keyscan_policy);
+  config_ = config;
+  // the factor threshold wins if both conflict
+  set_factor_threshold(config.factor_threshold);
 }
 
 Pose2D Slam::pose() const {
@@ -455,10 +1113,39 @@ const std::vector<LaserScan> & Slam::scans() {
   return scans_;
 }
 
+LaserScan Slam::scan(size_t scan_id) {
+  return PagedScan(scan_id);
+}
+
+LaserScan & Slam::PagedScan(size_t scan_id) {
+  if (store_) store_->Touch(scan_id, &scans_);
+  return scans_[scan_id];
+}
+
+void Slam::PushKeyScan(const LaserScan &scan) {
+  scans_.push_back(scan);
+  if (store_) store_->Insert(scans_.size() - 1, &scans_);
+}
+
+const std::vector<std::shared_ptr<Submap>> & Slam::submaps() const {
+  return submaps_;
+}
+
 #ifdef USE_ISAM
 std::vector<std::pair<Eigen::Vector2d, Eigen::Vector2d>> Slam::factors() {
   return graph_slam_.factors();
 }
+
+std::vector<std::pair<size_t, Pose2D>> Slam::graph_nodes() {
+  return graph_slam_.nodes();
+}
+
+std::vector<std::pair<size_t, size_t>> Slam::graph_edges(size_t first) const {
+  const std::vector<std::pair<size_t, size_t>> &edges = graph_slam_.edges();
+  if (first >= edges.size()) return std::vector<std::pair<size_t, size_t>>();
+  return std::vector<std::pair<size_t, size_t>>(edges.begin() + first,
+      edges.end());
+}
 #endif
 
 Pose2D Slam::EncoderToPose2D(double left, double right, double tread) {
@@ -477,33 +1164,91 @@ Pose2D Slam::EncoderToPose2D(double left, double right, double tread) {
 
 void Slam::UpdatePoseWithPose(Pose2D pose) {
   this->pose_ = pose * this->pose_;
+  Publish(false);
 }
 
 void Slam::UpdatePoseWithEncoder(double left, double right, double tread) {
   pose_ = EncoderToPose2D(left, right, tread) * pose_;
+  Publish(false);
   if (pose_update_callback)
     pose_update_callback(pose_);
 }
 
+Pose2D Slam::PredictPose(int64_t time_stamp) const {
+  if (config_.prediction == Prediction::kOdometry || history_.size() < 2)
+    return pose_;
+
+  // relative motion over the history, in the frame of its oldest pose
+  const Pose2D &oldest = history_.front().second;
+  const Pose2D &newest = history_.back().second;
+  Pose2D motion = newest * oldest.inverse();
+  double span = history_.back().first - history_.front().first;
+  double ahead = time_stamp - history_.back().first;
+  // without time stamps assume a steady scan rate
+  if (span <= 0 || ahead <= 0) {
+    span = history_.size() - 1;
+    ahead = 1;
+  }
+  double gain = ahead / span;
+  Pose2D velocity(motion.x() * gain, motion.y() * gain,
+      motion.theta() * gain);
+  if (config_.prediction == Prediction::kConstantVelocity)
+    return velocity * newest;
+
+  // blend with the odometry motion since the last corrected pose
+  Pose2D odometry = pose_ * newest.inverse();
+  double w = config_.prediction_blend;
+  double delta_theta = velocity.theta() - odometry.theta();
+  while (delta_theta < -M_PI) delta_theta += 2 * M_PI;
+  while (delta_theta >  M_PI) delta_theta -= 2 * M_PI;
+  Pose2D blended(w * velocity.x() + (1 - w) * odometry.x(),
+      w * velocity.y() + (1 - w) * odometry.y(),
+      odometry.theta() + w * delta_theta);
+  return blended * newest;
+}
+
+void Slam::RecordPose(int64_t time_stamp, bool reset) {
+  const size_t history_size = 5;
+  // an optimized graph moves the pose, the old motion no longer applies
+  if (reset)
+    history_.clear();
+  history_.push_back(std::make_pair(time_stamp, pose_));
+  while (history_.size() > history_size)
+    history_.pop_front();
+}
+
 void Slam::UpdatePoseWithLaserScan(const LaserScan &_scan) {
   LaserScan scan = _scan;
+  pose_ = PredictPose(scan.time_stamp());
   scan.set_pose(pose_);
+  scan.set_association(config_.association);
+  scan.set_matcher(config_.matcher);
+  scan.set_match_config(config_.match);
+  scan.set_thread_pool(pool_);
 
   // first scan
   if (scans_.empty()) {
-    scans_.push_back(scan);
+    PushKeyScan(scan);
+    if (submap_size_ > 0) {
+      submaps_.push_back(std::make_shared<Submap>(pose_));
+      submaps_.back()->Insert(0, scan, Pose2D());
+    }
 #ifdef USE_ISAM
     graph_slam_.AddPose2dFactor(0, pose_, 1);
+    if (submap_size_ == 0)
+      AddLandmarkFactors(scan, 0);
 #endif
     std::cout << "add key scan " << scans_.size() << ": "
       << pose_.ToJson() << std::endl;
+    RecordPose(scan.time_stamp(), true);
+    Publish(true);
     if (map_update_callback)
       map_update_callback();
     return;
   }
 
   // search for the closest scan
-  LaserScan *closest_scan = &(scans_[0]);
+  size_t closest = 0;
   double min_dist = DBL_MAX;
   for (size_t i = 0; i < scans_.size(); i++) {
     double dist = (scans_[i].pose().pos() -
@@ -512,63 +1257,267 @@ void Slam::UpdatePoseWithLaserScan(const LaserScan &_scan) {
         scan.pose().theta());;
     while (delta_theta < -M_PI) delta_theta += 2 * M_PI;
     while (delta_theta >  M_PI) delta_theta -= 2 * M_PI;
-    delta_theta *= keyscan_threshold_ / (M_PI_4 * 3.0);
+    delta_theta *= config_.keyscan_threshold / (M_PI_4 * 3.0);
 
     dist = sqrt(dist * dist + delta_theta * delta_theta);
     if (dist < min_dist) {
       min_dist = dist;
-      closest_scan = &(scans_[i]);
+      closest = i;
     }
   }
+  LaserScan *closest_scan = &PagedScan(closest);
 
+  // the overlap policy tracks as long as factors can still be made
+  bool add_keyscan = min_dist >= config_.keyscan_threshold;
+  if (config_.keyscan_policy == KeyScanPolicy::kOverlap)
+    add_keyscan = min_dist >= config_.factor_threshold;
 
-  if (min_dist < keyscan_threshold_) {
+  if (!add_keyscan) {
     // update pose
-    double ratio;
-    Pose2D pose_delta = closest_scan->ICP(scan, &ratio);
-    pose_ = pose_delta * closest_scan->pose();
+    MatchResult result = closest_scan->Match(scan, config_.tracking_budget);
+    // a diverged match keeps the predicted pose and counts as no overlap
+    bool diverged = result.status == MatchStatus::kDiverged;
+    if (!diverged)
+      pose_ = result.pose * closest_scan->pose();
+    if (config_.keyscan_policy == KeyScanPolicy::kOverlap) {
+      if (diverged || result.ratio < config_.keyscan_overlap) {
+        low_overlap_count_++;
+      } else {
+        low_overlap_count_ = 0;
+      }
+      add_keyscan = low_overlap_count_ >= config_.keyscan_hysteresis;
+      scan.set_pose(pose_);
+    }
+  }
+
+  if (add_keyscan) {
+    low_overlap_count_ = 0;
+    AddKeyScan(scan, closest);
   } else {
-    // add key scan
+    RecordPose(scan.time_stamp(), false);
+    Publish(false);
+  }
+  if (pose_update_callback)
+    pose_update_callback(pose_);
+}
+
+void Slam::AddKeyScan(LaserScan scan, size_t closest) {
+  if (submap_size_ > 0) {
+    InsertIntoSubmaps(scan);
+    std::cout << "add key scan " << scans_.size() << " to submap "
+      << submaps_.size() << ": " << pose_.ToJson() << std::endl;
+    Publish(true);
+    if (map_update_callback)
+      map_update_callback();
+    return;
+  }
+
 #ifdef USE_ISAM
-    size_t constrain_count = 0;
-    for (size_t i = 0; i < scans_.size(); i++) {
-      double distance = (pose_.pos() - scans_[i].pose().pos()).norm();
-      if (distance < factor_threshold_) {
-        constrain_count++;
-        double ratio;
-        Pose2D pose_delta = scans_[i].ICP(scan, &ratio);
-        graph_slam_.AddPose2dPose2dFactor(i, scans_.size(), pose_delta, ratio);
-      }
+  size_t constrain_count = 0;
+  for (size_t i = 0; i < scans_.size(); i++) {
+    double distance = (pose_.pos() - scans_[i].pose().pos()).norm();
+    // under the overlap policy a key scan can be further away than the
+    // factor threshold, the closest one keeps the graph connected
+    bool closest_overlap = i == closest &&
+      config_.keyscan_policy == KeyScanPolicy::kOverlap;
+    if (distance < config_.factor_threshold || closest_overlap) {
+      constrain_count++;
+      MatchResult result = PagedScan(i).Match(scan, config_.factor_budget);
+      graph_slam_.AddPose2dPose2dFactor(i, scans_.size(), result.pose,
+          result.ratio);
+    }
+  }
+  // a landmark seen again closes a loop without a match
+  constrain_count += AddLandmarkFactors(scan, scans_.size());
+  if (constrain_count > 1)
+    graph_slam_.Optimization();
+
+  auto nodes = graph_slam_.nodes();
+  for (size_t i = 0; i < nodes.size(); i++) {
+    // update pose of node
+    for (size_t j = 0; j < scans_.size(); j++) {
+      if (j != nodes[i].first) continue;
+      scans_[j].set_pose(nodes[i].second);
+      break;
     }
-    if (constrain_count > 1)
-      graph_slam_.Optimization();
-
-    auto nodes = graph_slam_.nodes();
-    for (size_t i = 0; i < nodes.size(); i++) {
-      // update pose of node
-      for (size_t j = 0; j < scans_.size(); j++) {
-        if (j != nodes[i].first) continue;
-        scans_[j].set_pose(nodes[i].second);
+    // add the new scan with pose
+    if (nodes[i].first == scans_.size()) {
+      pose_ = nodes[i].second;
+      scan.set_pose(nodes[i].second);
+      PushKeyScan(scan);
+    }
+  }
+  RecordPose(scan.time_stamp(), constrain_count > 1);
+#else
+  PushKeyScan(scan);
+  RecordPose(scan.time_stamp(), false);
+#endif
+  std::cout << "add key scan " << scans_.size() << ": "
+    << pose_.ToJson() << std::endl;
+
+  Publish(true);
+  if (map_update_callback)
+    map_update_callback();
+}
+
+void Slam::InsertIntoSubmaps(LaserScan scan) {
+  size_t scan_id = scans_.size();
+  size_t current = submaps_.size() - 1;
+
+  // scan to submap match against the precomputed grid
+  Pose2D local = pose_ * submaps_[current]->pose().inverse();
+  MatchResult result = submaps_[current]->Match(scan, local,
+      config_.factor_budget);
+  local = result.pose;
+  pose_ = local * submaps_[current]->pose();
+
+  // a full submap is frozen and the scan starts the next one
+  size_t holder = current;
+  if (submaps_[current]->size() >= submap_size_) {
+    submaps_[current]->Finish();
+    submaps_.push_back(std::make_shared<Submap>(pose_));
+    holder = submaps_.size() - 1;
+#ifdef USE_ISAM
+    graph_slam_.AddPose2dPose2dFactor(current, holder, local, result.ratio);
+#endif
+    local = Pose2D();
+  }
+  scan.set_pose(pose_);
+  submaps_[holder]->Insert(scan_id, scan, local);
+  PushKeyScan(scan);
+
+#ifdef USE_ISAM
+  // scan to submap constraints against finished submaps nearby
+  size_t constrain_count = 0;
+  for (size_t k = 0; k < submaps_.size(); k++) {
+    if (k == holder || k == current || !submaps_[k]->finished()) continue;
+    bool near = false;
+    for (auto &entry : submaps_[k]->scans()) {
+      if ((scans_[entry.first].pose().pos() - pose_.pos()).norm() <
+          config_.factor_threshold) {
+        near = true;
         break;
       }
-      // add the new scan with pose
-      if (nodes[i].first == scans_.size()) {
-        pose_ = nodes[i].second;
-        scan.set_pose(nodes[i].second);
-        scans_.push_back(scan);
-      }
     }
+    if (!near) continue;
+    Pose2D guess = pose_ * submaps_[k]->pose().inverse();
+    MatchResult loop = submaps_[k]->Match(scan, guess, config_.factor_budget);
+    graph_slam_.AddPose2dPose2dFactor(k, holder, local.inverse() * loop.pose,
+        loop.ratio);
+    constrain_count++;
+  }
+  if (constrain_count > 0)
+    graph_slam_.Optimization();
+
+  // move the submaps and the key scans they hold rigidly
+  auto nodes = graph_slam_.nodes();
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i].first >= submaps_.size()) continue;
+    Submap &submap = *submaps_[nodes[i].first];
+    submap.set_pose(nodes[i].second);
+    for (auto &entry : submap.scans())
+      scans_[entry.first].set_pose(entry.second * submap.pose());
+  }
+  pose_ = scans_.back().pose();
+  RecordPose(scan.time_stamp(), constrain_count > 0);
 #else
-    scans_.push_back(scan);
+  RecordPose(scan.time_stamp(), false);
 #endif
-    std::cout << "add key scan " << scans_.size() << ": "
-      << pose_.ToJson() << std::endl;
+}
 
-    if (map_update_callback)
-      map_update_callback();
+#ifdef USE_ISAM
+size_t Slam::AddLandmarkFactors(const LaserScan &scan, size_t scan_id) {
+  const LandmarkConfig &config = config_.landmark;
+  if (config.intensity <= 0.0) return 0;
+  std::vector<Eigen::Vector2d> reflectors =
+    pgslam::ExtractReflectors(scan, config);
+  std::vector<Eigen::Vector2d> landmarks = graph_slam_.landmarks();
+  std::vector<int> associations = pgslam::AssociateReflectors(reflectors,
+      pose_, landmarks, config.gate);
+  size_t seen = 0;
+  size_t landmark_id = landmarks.size();
+  for (size_t i = 0; i < reflectors.size(); i++) {
+    if (associations[i] >= 0) seen++;
+    graph_slam_.AddPose2dPoint2dFactor(scan_id, associations[i] >= 0 ?
+        associations[i] : landmark_id++, reflectors[i], config.weight);
   }
-  if (pose_update_callback)
-    pose_update_callback(pose_);
+  return seen;
+}
+#endif
+
+std::shared_ptr<const SlamSnapshot> Slam::snapshot() const {
+  return std::atomic_load(&snapshot_);
+}
+
+void Slam::Publish(bool map_changed) {
+  std::shared_ptr<SlamSnapshot> snapshot(new SlamSnapshot());
+  std::shared_ptr<const SlamSnapshot> last = std::atomic_load(&snapshot_);
+  snapshot->version = ++version_;
+  snapshot->pose = pose_;
+  if (!history_.empty())
+    snapshot->time_stamp = history_.back().first;
+  snapshot->store = store_;
+  if (last && !map_changed) {
+    snapshot->map_version = last->map_version;
+    snapshot->scans = last->scans;
+    snapshot->submaps = last->submaps;
+    snapshot->graph_nodes = last->graph_nodes;
+    snapshot->graph_edges = last->graph_edges;
+    snapshot->landmarks = last->landmarks;
+    snapshot->landmark_edges = last->landmark_edges;
+    std::atomic_store(&snapshot_,
+        std::shared_ptr<const SlamSnapshot>(snapshot));
+    return;
+  }
+
+  // copies are cheap since points are shared, and only the scans that
+  // moved or were paged in or out since the last snapshot are copied
+  snapshot->map_version = ++map_version_;
+  scan_handles_.resize(scans_.size());
+  for (size_t i = 0; i < scans_.size(); i++) {
+    const std::shared_ptr<const LaserScan> &handle = scan_handles_[i];
+    if (handle && handle->resident() == scans_[i].resident() &&
+        handle->pose().x() == scans_[i].pose().x() &&
+        handle->pose().y() == scans_[i].pose().y() &&
+        handle->pose().theta() == scans_[i].pose().theta()) continue;
+    scan_handles_[i] = std::make_shared<const LaserScan>(scans_[i]);
+  }
+  submap_handles_.resize(submaps_.size());
+  for (size_t k = 0; k < submaps_.size(); k++) {
+    const std::shared_ptr<const Submap> &handle = submap_handles_[k];
+    const Submap &submap = *submaps_[k];
+    if (handle && handle->size() == submap.size() &&
+        handle->finished() == submap.finished() &&
+        handle->pose().x() == submap.pose().x() &&
+        handle->pose().y() == submap.pose().y() &&
+        handle->pose().theta() == submap.pose().theta()) continue;
+    submap_handles_[k] = std::make_shared<const Submap>(submap);
+  }
+  snapshot->scans = std::make_shared<const LaserScanHandles>(scan_handles_);
+  snapshot->submaps = std::make_shared<const SubmapHandles>(submap_handles_);
+#ifdef USE_ISAM
+  snapshot->graph_nodes =
+    std::make_shared<const std::vector<std::pair<size_t, Pose2D>>>(
+        graph_slam_.nodes());
+  snapshot->graph_edges =
+    std::make_shared<const std::vector<std::pair<size_t, size_t>>>(
+        graph_slam_.edges());
+  snapshot->landmarks =
+    std::make_shared<const std::vector<Eigen::Vector2d>>(
+        graph_slam_.landmarks());
+  snapshot->landmark_edges =
+    std::make_shared<const std::vector<std::pair<size_t, size_t>>>(
+        graph_slam_.landmark_edges());
+#else
+  snapshot->graph_nodes =
+    std::make_shared<const std::vector<std::pair<size_t, Pose2D>>>();
+  snapshot->graph_edges =
+    std::make_shared<const std::vector<std::pair<size_t, size_t>>>();
+  snapshot->landmarks = std::make_shared<const std::vector<Eigen::Vector2d>>();
+  snapshot->landmark_edges =
+    std::make_shared<const std::vector<std::pair<size_t, size_t>>>();
+#endif
+  std::atomic_store(&snapshot_, std::shared_ptr<const SlamSnapshot>(snapshot));
 }
 
 void Slam::RegisterPoseUpdateCallback(std::function<void(Pose2D)> f) {
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/scan_store.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+namespace pgslam {
+
+// location of a scan whose points could not be written
+const size_t kNotStored = static_cast<size_t>(-1);
+
+ScanStore::ScanStore(const std::string &directory, double tile_size,
+    size_t max_tiles) {
+  directory_ = directory;
+  tile_size_ = tile_size > 0 ? tile_size : 20.0;
+  max_tiles_ = max_tiles > 0 ? max_tiles : 1;
+  ok_ = true;
+  if (mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST) {
+    std::cout << "Error: cannot create scan store " << directory_
+      << ": " << strerror(errno) << std::endl;
+    ok_ = false;
+  }
+}
+
+ScanStore::~ScanStore() {
+  for (size_t i = 0; i < tiles_.size(); i++) {
+    Unmap(&tiles_[i]);
+    if (tiles_[i].fd < 0) continue;
+    close(tiles_[i].fd);
+    unlink(tiles_[i].path.c_str());
+  }
+}
+
+bool ScanStore::ok() const {
+  return ok_;
+}
+
+size_t ScanStore::resident_tiles() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return lru_.size();
+}
+
+size_t ScanStore::TileAt(Pose2D pose) {
+  std::pair<int, int> key(
+      static_cast<int>(std::floor(pose.x() / tile_size_)),
+      static_cast<int>(std::floor(pose.y() / tile_size_)));
+  auto found = tile_index_.find(key);
+  if (found != tile_index_.end()) return found->second;
+
+  std::ostringstream path;
+  path << directory_ << "/tile_" << key.first << "_" << key.second << ".bin";
+  Tile tile;
+  tile.path = path.str();
+  // left over files of an earlier run are overwritten
+  tile.fd = open(tile.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (tile.fd < 0) {
+    std::cout << "Error: cannot open " << tile.path << ": "
+      << strerror(errno) << std::endl;
+  }
+  tile.data = NULL;
+  tile.mapped = 0;
+  tile.size = 0;
+  tiles_.push_back(tile);
+  tile_index_[key] = tiles_.size() - 1;
+  return tiles_.size() - 1;
+}
+
+bool ScanStore::Map(Tile *tile) {
+  if (tile->data != NULL && tile->mapped == tile->size) return true;
+  Unmap(tile);
+  if (tile->fd < 0 || tile->size == 0) return false;
+  void *data = mmap(NULL, tile->size, PROT_READ, MAP_SHARED, tile->fd, 0);
+  if (data == MAP_FAILED) {
+    std::cout << "Error: cannot map " << tile->path << ": "
+      << strerror(errno) << std::endl;
+    return false;
+  }
+  tile->data = data;
+  tile->mapped = tile->size;
+  return true;
+}
+
+void ScanStore::Unmap(Tile *tile) {
+  if (tile->data == NULL) return;
+  munmap(tile->data, tile->mapped);
+  tile->data = NULL;
+  tile->mapped = 0;
+}
+
+void ScanStore::Use(size_t tile, std::vector<LaserScan> *scans) {
+  auto it = std::find(lru_.begin(), lru_.end(), tile);
+  if (it != lru_.end()) {
+    lru_.splice(lru_.begin(), lru_, it);
+  } else {
+    lru_.push_front(tile);
+  }
+
+  // the used tile is in front, so it is never the one evicted
+  while (lru_.size() > max_tiles_) {
+    Tile &victim = tiles_[lru_.back()];
+    lru_.pop_back();
+    for (size_t i = 0; i < victim.scans.size(); i++)
+      (*scans)[victim.scans[i]].Release();
+    Unmap(&victim);
+  }
+}
+
+void ScanStore::Insert(size_t scan_id, std::vector<LaserScan> *scans) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (locations_.size() <= scan_id) {
+    Location none = {kNotStored, 0, 0};
+    locations_.resize(scan_id + 1, none);
+  }
+  if (!ok_) return;
+
+  const LaserScan &scan = (*scans)[scan_id];
+  size_t index = TileAt(scan.pose());
+  Tile &tile = tiles_[index];
+  if (tile.fd < 0) return;
+
+  // append, a scan that fails to be written just stays in memory
+  const Eigen::Matrix2Xd &points = scan.local_points();
+  const char *data = reinterpret_cast<const char *>(points.data());
+  size_t bytes = points.size() * sizeof(double);
+  size_t written = 0;
+  while (written < bytes) {
+    ssize_t n = pwrite(tile.fd, data + written, bytes - written,
+        tile.size + written);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      std::cout << "Error: cannot write " << tile.path << ": "
+        << strerror(errno) << std::endl;
+      return;
+    }
+    written += n;
+  }
+
+  Location location = {index, tile.size / sizeof(double),
+    static_cast<size_t>(points.cols())};
+  locations_[scan_id] = location;
+  tile.size += bytes;
+  tile.scans.push_back(scan_id);
+  Use(index, scans);
+}
+
+void ScanStore::Touch(size_t scan_id, std::vector<LaserScan> *scans) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (scan_id >= locations_.size()) return;
+  const Location &location = locations_[scan_id];
+  if (location.tile == kNotStored) return;
+
+  LaserScan &scan = (*scans)[scan_id];
+  if (!scan.resident()) {
+    Tile &tile = tiles_[location.tile];
+    if (!Map(&tile)) return;
+    Eigen::Map<const Eigen::Matrix2Xd> points(
+        static_cast<const double *>(tile.data) + location.offset,
+        2, location.count);
+    scan.Restore(points);
+  }
+  Use(location.tile, scans);
+}
+
+bool ScanStore::Load(size_t scan_id, Eigen::Matrix2Xd *points) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (scan_id >= locations_.size()) return false;
+  const Location &location = locations_[scan_id];
+  if (location.tile == kNotStored) return false;
+
+  // read instead of map, the mapping belongs to the slam thread and may
+  // be dropped as soon as the lock is released
+  const Tile &tile = tiles_[location.tile];
+  points->resize(2, location.count);
+  char *data = reinterpret_cast<char *>(points->data());
+  size_t bytes = points->size() * sizeof(double);
+  off_t offset = location.offset * sizeof(double);
+  size_t done = 0;
+  while (done < bytes) {
+    ssize_t n = pread(tile.fd, data + done, bytes - done, offset + done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      std::cout << "Error: cannot read " << tile.path << ": "
+        << strerror(errno) << std::endl;
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+}  // namespace pgslam
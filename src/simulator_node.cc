@@ -0,0 +1,188 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <ros/ros.h>
+#include <sensor_msgs/LaserScan.h>
+#include <nav_msgs/Odometry.h>
+#include <tf/transform_broadcaster.h>
+
+#include <pgslam/pgslam.h>
+#include <pgslam/lidar_simulator.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+// plays the simulator as a lidar and odometry would, on scan, odom and
+// the odom to base tf, with the true pose on ground_truth
+void Publish(const pgslam::LidarSimulator &simulator,
+    const pgslam::SimulatedScan &scan, ros::Time stamp,
+    const std::string &odom_frame, const std::string &base_frame,
+    const ros::Publisher &scan_pub, const ros::Publisher &odom_pub,
+    const ros::Publisher &truth_pub, tf::TransformBroadcaster *broadcaster) {
+  const pgslam::SimulatorConfig &config = simulator.config();
+  sensor_msgs::LaserScan msg;
+  msg.header.stamp = stamp;
+  msg.header.frame_id = base_frame;
+  msg.angle_min = config.angle_min;
+  msg.angle_increment = simulator.angle_increment();
+  msg.angle_max = config.angle_min +
+    msg.angle_increment * (config.beams - 1);
+  msg.time_increment = 1.0 / config.rate / config.beams;
+  msg.scan_time = 1.0 / config.rate;
+  msg.range_min = 0.0;
+  msg.range_max = config.range_max;
+  msg.ranges.resize(scan.echos.size());
+  msg.intensities.resize(scan.echos.size());
+  for (size_t i = 0; i < scan.echos.size(); i++) {
+    msg.ranges[i] = scan.echos[i].range();
+    msg.intensities[i] = scan.echos[i].intensity();
+  }
+
+  // odometry first, so it is there when the scan is looked up
+  tf::Transform transform;
+  transform.setOrigin(tf::Vector3(scan.odometry.x(), scan.odometry.y(), 0));
+  tf::Quaternion q;
+  q.setRPY(0, 0, scan.odometry.theta());
+  transform.setRotation(q);
+  broadcaster->sendTransform(tf::StampedTransform(transform, stamp,
+        odom_frame, base_frame));
+
+  nav_msgs::Odometry odom;
+  odom.header.stamp = stamp;
+  odom.header.frame_id = odom_frame;
+  odom.child_frame_id = base_frame;
+  odom.pose.pose.position.x = scan.odometry.x();
+  odom.pose.pose.position.y = scan.odometry.y();
+  odom.pose.pose.orientation.z = sin(scan.odometry.theta() / 2);
+  odom.pose.pose.orientation.w = cos(scan.odometry.theta() / 2);
+  odom_pub.publish(odom);
+
+  nav_msgs::Odometry truth = odom;
+  truth.header.frame_id = "world";
+  truth.pose.pose.position.x = scan.truth.x();
+  truth.pose.pose.position.y = scan.truth.y();
+  truth.pose.pose.orientation.z = sin(scan.truth.theta() / 2);
+  truth.pose.pose.orientation.w = cos(scan.truth.theta() / 2);
+  truth_pub.publish(truth);
+
+  scan_pub.publish(msg);
+}
+
+// feeds a slam in this process as fast as it takes the scans, no topics
+void Drive(pgslam::LidarSimulator *simulator, size_t scans) {
+  pgslam::Slam slam;
+  pgslam::Pose2D odom_old;
+  pgslam::Pose2D start;
+  double worst = 0.0;
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < scans && ros::ok(); i++) {
+    pgslam::SimulatedScan scan = simulator->Next();
+    if (i == 0) start = scan.truth;
+    slam.UpdatePoseWithPose(scan.odometry * odom_old.inverse());
+    odom_old = scan.odometry;
+    slam.UpdatePoseWithLaserScan(pgslam::LaserScan(scan.echos));
+
+    // slam starts at the origin, the truth where the trajectory does
+    pgslam::Pose2D truth = scan.truth * start.inverse();
+    pgslam::Pose2D pose = slam.snapshot()->pose;
+    worst = std::max(worst, (pose.pos() - truth.pos()).norm());
+  }
+  double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - begin).count();
+  ROS_INFO("%zu scans in %.2f s, %.1f scans/s, worst position error %.3f m",
+      scans, seconds, scans / seconds, worst);
+}
+
+int main(int argc, char **argv) {
+  ros::init(argc, argv, "pgslam_simulator");
+  ros::NodeHandle node;
+
+  // a map_server yaml to load, or rooms generated from the seed
+  std::string world_file = "";
+  int rooms_x = 3;
+  int rooms_y = 2;
+  double room_size = 6.0;
+  double world_resolution = 0.05;
+  std::vector<double> waypoints;  // x0, y0, x1, y1, ...
+  std::string mode = "topics";
+  double laps = 0.0;  // forever if not positive
+  std::string odom_frame = "odom";
+  std::string base_frame = "base_link";
+  pgslam::SimulatorConfig config;
+  int seed = 0;
+  ros::param::get("~world", world_file);
+  ros::param::get("~rooms_x", rooms_x);
+  ros::param::get("~rooms_y", rooms_y);
+  ros::param::get("~room_size", room_size);
+  ros::param::get("~world_resolution", world_resolution);
+  ros::param::get("~waypoints", waypoints);
+  ros::param::get("~mode", mode);
+  ros::param::get("~laps", laps);
+  ros::param::get("~odom_frame", odom_frame);
+  ros::param::get("~base_frame", base_frame);
+  ros::param::get("~beams", config.beams);
+  ros::param::get("~rate", config.rate);
+  ros::param::get("~angle_min", config.angle_min);
+  ros::param::get("~angle_max", config.angle_max);
+  ros::param::get("~range_max", config.range_max);
+  ros::param::get("~range_noise", config.range_noise);
+  ros::param::get("~dropout", config.dropout);
+  ros::param::get("~odometry_noise", config.odometry_noise);
+  ros::param::get("~heading_noise", config.heading_noise);
+  ros::param::get("~speed", config.speed);
+  ros::param::get("~turn_rate", config.turn_rate);
+  ros::param::get("~seed", seed);
+  config.seed = seed;
+
+  pgslam::World world;
+  if (world_file.empty()) {
+    world = pgslam::World::Generate(rooms_x, rooms_y, room_size,
+        world_resolution, config.seed);
+  } else if (!pgslam::World::Load(world_file, &world)) {
+    return 1;
+  }
+  if (waypoints.size() >= 2) {
+    std::vector<Eigen::Vector2d> points;
+    for (size_t i = 0; i + 1 < waypoints.size(); i += 2)
+      points.push_back(Eigen::Vector2d(waypoints[i], waypoints[i + 1]));
+    world.set_waypoints(points);
+  } else if (!world_file.empty()) {
+    ROS_WARN("no waypoints for %s, stand at the origin", world_file.c_str());
+  }
+
+  pgslam::LidarSimulator simulator(world, config);
+  double period = simulator.trajectory().period();
+  size_t scans = laps > 0.0 && period > 0.0 ?
+    static_cast<size_t>(ceil(laps * period * simulator.config().rate)) : 0;
+  ROS_INFO("%d beams at %.1f Hz, %.1f s per lap", simulator.config().beams,
+      simulator.config().rate, period);
+
+  if (mode == "direct") {
+    if (scans == 0) scans = std::max(period, 1.0) * simulator.config().rate;
+    Drive(&simulator, scans);
+    return 0;
+  } else if (mode != "topics") {
+    ROS_WARN("unknown mode %s, use topics", mode.c_str());
+  }
+
+  ros::Publisher scan_pub = node.advertise<sensor_msgs::LaserScan>("scan", 10);
+  ros::Publisher odom_pub = node.advertise<nav_msgs::Odometry>("odom", 10);
+  ros::Publisher truth_pub =
+    node.advertise<nav_msgs::Odometry>("ground_truth", 10);
+  tf::TransformBroadcaster broadcaster;
+  ros::Rate rate(simulator.config().rate);
+  ros::Time start = ros::Time::now();
+  for (size_t i = 0; ros::ok() && (scans == 0 || i < scans); i++) {
+    pgslam::SimulatedScan scan = simulator.Next();
+    ros::Time stamp = start + ros::Duration(scan.time_stamp * 1e-9);
+    Publish(simulator, scan, stamp, odom_frame, base_frame, scan_pub,
+        odom_pub, truth_pub, &broadcaster);
+    ros::spinOnce();
+    rate.sleep();
+  }
+
+  return 0;
+}
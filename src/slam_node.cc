@@ -0,0 +1,904 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/slam_node.h>
+
+#include <Eigen/Eigen>
+#include <map_msgs/OccupancyGridUpdate.h>
+
+#include <pgslam/config.h>
+#include <pgslam/map_export.h>
+#include <pgslam/submap.h>
+#include <pgslam/scan_store.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+
+namespace pgslam {
+
+namespace {
+
+// scans waiting for the slam strand, the oldest is dropped beyond this
+const size_t kScanQueueSize = 10;
+// longest a scan waits for the odometry at its time stamp
+const double kOdometryTimeout = 0.5;
+// points per graph marker, even so line lists never split a factor
+const size_t kMarkerChunk = 1000;
+// the live map grows by blocks of this many meters, so it keeps its
+// geometry while the robot explores and updates stay partial
+const double kMapChunk = 10.0;
+
+// tile of a submap in its own frame, rendered once it is finished
+GridMap RenderSubmap(const SlamSnapshot &snapshot, const Submap &submap,
+    double resolution, double draw_range) {
+  Eigen::Vector2d min = submap.min_point() - Eigen::Vector2d(1.0, 1.0);
+  Eigen::Vector2d max = submap.max_point() + Eigen::Vector2d(1.0, 1.0);
+  GridMap tile(resolution, min,
+      (max.x() - min.x()) / resolution, (max.y() - min.y()) / resolution);
+  for (auto &entry : submap.scans()) {
+    LaserScan scan = snapshot.scan(entry.first);
+    tile.DrawScan(scan, entry.second, draw_range);
+  }
+  return tile;
+}
+
+// min_x, min_y, max_x, max_y of the cells that differ from the last
+// published grid, max_x < 0 if none. false when the geometry changed
+bool ChangedBox(const GridMap &map,
+    const nav_msgs::OccupancyGrid &last, int box[4]) {
+  int width = map.width();
+  int height = map.height();
+  box[0] = width;
+  box[1] = height;
+  box[2] = -1;
+  box[3] = -1;
+  if (last.data.size() != map.data().size() ||
+      last.info.width != static_cast<uint32_t>(width) ||
+      last.info.resolution != static_cast<float>(map.resolution()) ||
+      last.info.origin.position.x != map.origin().x() ||
+      last.info.origin.position.y != map.origin().y())
+    return false;
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      size_t index = static_cast<size_t>(y) * width + x;
+      if (last.data[index] == map.data()[index]) continue;
+      box[0] = std::min(box[0], x);
+      box[2] = std::max(box[2], x);
+      box[1] = std::min(box[1], y);
+      box[3] = std::max(box[3], y);
+    }
+  }
+  return true;
+}
+
+// origin and size of a map covering every key scan
+void MapGeometry(const SlamSnapshot &snapshot, double resolution,
+    Eigen::Vector2d *origin, int *width, int *height) {
+  double max_x = 0.0;
+  double min_x = 0.0;
+  double max_y = 0.0;
+  double min_y = 0.0;
+  const LaserScanHandles &scans = *snapshot.scans;
+  for (size_t i = 0; i < scans.size(); i++) {
+    LaserScan scan = *scans[i];  // bounds are cached in the copy
+    if (max_x < scan.max_x_in_world())
+      max_x = scan.max_x_in_world();
+    if (min_x > scan.min_x_in_world())
+      min_x = scan.min_x_in_world();
+    if (max_y < scan.max_y_in_world())
+      max_y = scan.max_y_in_world();
+    if (min_y > scan.min_y_in_world())
+      min_y = scan.min_y_in_world();
+  }
+  double max_x_i = static_cast<int>((max_x + 1.0) * 10) / 10.0;
+  double min_x_i = static_cast<int>((min_x - 1.0) * 10) / 10.0;
+  double max_y_i = static_cast<int>((max_y + 1.0) * 10) / 10.0;
+  double min_y_i = static_cast<int>((min_y - 1.0) * 10) / 10.0;
+  *origin = Eigen::Vector2d(min_x_i, min_y_i);
+  *width  = (max_x_i - min_x_i) / resolution;
+  *height = (max_y_i - min_y_i) / resolution;
+}
+
+// grows a map geometry outward to whole kMapChunk blocks
+void ChunkGeometry(double resolution, Eigen::Vector2d *origin, int *width,
+    int *height) {
+  double min_x = std::floor(origin->x() / kMapChunk) * kMapChunk;
+  double min_y = std::floor(origin->y() / kMapChunk) * kMapChunk;
+  double max_x = std::ceil((origin->x() + *width * resolution) / kMapChunk) *
+    kMapChunk;
+  double max_y = std::ceil((origin->y() + *height * resolution) / kMapChunk) *
+    kMapChunk;
+  *origin = Eigen::Vector2d(min_x, min_y);
+  *width = std::lround((max_x - min_x) / resolution);
+  *height = std::lround((max_y - min_y) / resolution);
+}
+
+std::vector<Echo> RosLaserScan_T_Echos(const sensor_msgs::LaserScan& msg) {
+  std::vector<Echo> echos;
+  size_t i = 0;
+  int64_t stamp = msg.header.stamp.toNSec();
+  for (double angle = msg.angle_min; angle <= msg.angle_max;
+      angle += msg.angle_increment, i++) {
+    int64_t time_stamp = stamp +
+      static_cast<int64_t>(i * msg.time_increment * 1e9);
+    echos.push_back(Echo(msg.ranges[i], angle, msg.intensities[i],
+          time_stamp));
+  }
+  return echos;
+}
+
+}  // namespace
+
+SlamNode::SlamNode(const std::string &robot, ThreadPool *pool,
+    tf::TransformListener *listener)
+    : robot_(robot), node_(robot), listener_(listener),
+      slam_strand_(pool), render_strand_(pool) {
+  // large scans spread their matches over the same pool
+  slam_.set_thread_pool(pool);
+  tile_resolution_ = 0.0;
+  tile_draw_range_ = 0.0;
+  scans_posted_ = false;
+  render_queued_ = false;
+  map_dirty_ = false;
+  graph_dirty_ = false;
+  LoadParams();
+  Configure();
+  Advertise();
+}
+
+// the shared ~name, overridden by ~robot/name
+template <typename T>
+void SlamNode::Param(const std::string &name, T *value) const {
+  ros::param::get("~" + name, *value);
+  if (!robot_.empty())
+    ros::param::get("~" + robot_ + "/" + name, *value);
+}
+
+void SlamNode::LoadParams() {
+  // robots keep apart in tf unless their frames are set
+  std::string prefix = robot_.empty() ? "" : robot_ + "/";
+  map_frame_ = prefix + "map";
+  odom_frame_ = prefix + "odom";
+  base_frame_ = prefix + "base_link";
+  pose_rate_ = 100.0;
+  graph_rate_ = 1.0;
+  submap_size_ = 0;
+  graph_cluster_size_ = 0;
+  scan_store_directory_ = "";
+  scan_store_tile_size_ = 20.0;
+  scan_store_max_tiles_ = 16;
+  fusion_window_ = 0.05;
+
+  Param("map_frame", &map_frame_);
+  Param("odom_frame", &odom_frame_);
+  Param("base_frame", &base_frame_);
+  Param("pose_rate", &pose_rate_);
+  Param("submap_size", &submap_size_);
+  Param("graph_cluster_size", &graph_cluster_size_);
+  Param("pyramid_factors", &pyramid_factors_);
+  Param("graph_rate", &graph_rate_);
+  Param("scan_store_directory", &scan_store_directory_);
+  Param("scan_store_tile_size", &scan_store_tile_size_);
+  Param("scan_store_max_tiles", &scan_store_max_tiles_);
+  Param("scan_topics", &scan_topics_);
+  Param("fusion_window", &fusion_window_);
+
+  // the reconfigurable ones, defaults are in cfg/PGSlam.cfg
+  params_ = PGSlamConfig::__getDefault__();
+  Param("keyscan_threshold", &params_.keyscan_threshold);
+  Param("factor_threshold", &params_.factor_threshold);
+  Param("keyscan_policy", &params_.keyscan_policy);
+  Param("keyscan_overlap", &params_.keyscan_overlap);
+  Param("keyscan_hysteresis", &params_.keyscan_hysteresis);
+  Param("association", &params_.association);
+  Param("matcher", &params_.matcher);
+  Param("tracking_time_budget", &params_.tracking_time_budget);
+  Param("tracking_iterations", &params_.tracking_iterations);
+  Param("factor_time_budget", &params_.factor_time_budget);
+  Param("factor_iterations", &params_.factor_iterations);
+  Param("prediction", &params_.prediction);
+  Param("prediction_blend", &params_.prediction_blend);
+  Param("match_threshold", &params_.match_threshold);
+  Param("dist_threshold", &params_.dist_threshold);
+  Param("interpolation", &params_.interpolation);
+  Param("trim_ratio", &params_.trim_ratio);
+  Param("max_shared", &params_.max_shared);
+  Param("projective_window", &params_.projective_window);
+  Param("covariance_radius", &params_.covariance_radius);
+  Param("ndt_resolution", &params_.ndt_resolution);
+  Param("precision", &params_.precision);
+  Param("rejection", &params_.rejection);
+  Param("solver", &params_.solver);
+  Param("parallel_points", &params_.parallel_points);
+  Param("landmark_intensity", &params_.landmark_intensity);
+  Param("landmark_min_points", &params_.landmark_min_points);
+  Param("landmark_max_size", &params_.landmark_max_size);
+  Param("landmark_gate", &params_.landmark_gate);
+  Param("landmark_weight", &params_.landmark_weight);
+  Param("resolution", &params_.resolution);
+  Param("draw_range", &params_.draw_range);
+  Param("full_map_interval", &params_.full_map_interval);
+  Param("graph_tolerance", &params_.graph_tolerance);
+  Param("map_file", &params_.map_file);
+  Param("map_format", &params_.map_format);
+  Reconfigure(params_, 0);
+}
+
+void SlamNode::Configure() {
+  slam_config_ = config();
+  slam_.set_config(slam_config_->slam);
+  if (submap_size_ > 0)
+    slam_.set_submap_size(submap_size_);
+  if (graph_cluster_size_ > 0)
+    slam_.set_graph_cluster_size(graph_cluster_size_);
+  if (!scan_store_directory_.empty()) {
+    // robots sharing a directory would overwrite each other's tiles
+    std::string directory = scan_store_directory_;
+    if (!robot_.empty()) directory += "/" + robot_;
+    auto store = std::make_shared<ScanStore>(directory,
+        scan_store_tile_size_, std::max(scan_store_max_tiles_, 1));
+    if (store->ok())
+      slam_.set_scan_store(store);
+  }
+
+  // both run on the slam strand
+  slam_.RegisterMapUpdateCallback([this]() {
+    RequestRender(true, graph_rate_ <= 0.0);
+  });
+  slam_.RegisterPoseUpdateCallback([this](Pose2D pose) {
+    BroadcastPose(pose);
+  });
+}
+
+std::shared_ptr<const SlamNode::Config> SlamNode::config() const {
+  return std::atomic_load(&config_);
+}
+
+// on a spinner thread. the strands pick the new config up with their
+// next scan or render, an unknown name keeps the option as it was
+void SlamNode::Reconfigure(PGSlamConfig &params, uint32_t level) {
+  auto old = config();
+  std::shared_ptr<Config> config =
+    old ? std::make_shared<Config>(*old) : std::make_shared<Config>();
+  SlamConfig &slam = config->slam;
+  slam.keyscan_threshold = params.keyscan_threshold;
+  slam.factor_threshold = params.factor_threshold;
+  if (!ParseKeyScanPolicy(params.keyscan_policy, &slam.keyscan_policy))
+    ROS_WARN("unknown keyscan policy %s", params.keyscan_policy.c_str());
+  slam.keyscan_overlap = params.keyscan_overlap;
+  slam.keyscan_hysteresis = params.keyscan_hysteresis;
+  if (!ParseAssociation(params.association, &slam.association))
+    ROS_WARN("unknown association %s", params.association.c_str());
+  if (!ParseMatcher(params.matcher, &slam.matcher))
+    ROS_WARN("unknown matcher %s", params.matcher.c_str());
+  slam.tracking_budget.max_time = params.tracking_time_budget;
+  slam.tracking_budget.max_iterations = params.tracking_iterations;
+  slam.factor_budget.max_time = params.factor_time_budget;
+  slam.factor_budget.max_iterations = params.factor_iterations;
+  if (!ParsePrediction(params.prediction, &slam.prediction))
+    ROS_WARN("unknown prediction %s", params.prediction.c_str());
+  slam.prediction_blend = params.prediction_blend;
+  MatchConfig &match = slam.match;
+  match.match_threshold = params.match_threshold;
+  match.dist_threshold = params.dist_threshold;
+  match.interpolation = params.interpolation;
+  match.trim_ratio = params.trim_ratio;
+  match.max_shared = params.max_shared;
+  match.projective_window = params.projective_window;
+  match.covariance_radius = params.covariance_radius;
+  match.ndt_resolution = params.ndt_resolution;
+  if (!ParsePrecision(params.precision, &match.precision))
+    ROS_WARN("unknown precision %s", params.precision.c_str());
+  if (!ParseRejection(params.rejection, &match.rejection))
+    ROS_WARN("unknown rejection %s", params.rejection.c_str());
+  if (!ParseSolver(params.solver, &match.solver))
+    ROS_WARN("unknown solver %s", params.solver.c_str());
+  match.parallel_points = params.parallel_points;
+  LandmarkConfig &landmark = slam.landmark;
+  landmark.intensity = params.landmark_intensity;
+  landmark.min_points = params.landmark_min_points;
+  landmark.max_size = params.landmark_max_size;
+  landmark.gate = params.landmark_gate;
+  landmark.weight = params.landmark_weight;
+  config->resolution = params.resolution;
+  config->draw_range = params.draw_range;
+  config->full_map_interval = params.full_map_interval;
+  config->graph_tolerance = params.graph_tolerance;
+  config->map_file = params.map_file;
+  config->map_format = params.map_format;
+  params_ = params;
+  std::atomic_store(&config_, std::shared_ptr<const Config>(config));
+}
+
+void SlamNode::Advertise() {
+  // topics are relative, so each robot gets its own under its namespace
+  std::vector<std::string> topics = scan_topics_;
+  if (topics.empty()) topics.push_back("scan");
+  latest_scans_.resize(topics.size());
+  for (size_t k = 0; k < topics.size(); k++) {
+    auto callback = [this, k](const sensor_msgs::LaserScanConstPtr &msg) {
+      ScanCallback(msg, k);
+    };
+    scan_subs_.push_back(node_.subscribe<sensor_msgs::LaserScan>(topics[k],
+          kScanQueueSize, callback));
+  }
+  node_pub_ = node_.advertise<visualization_msgs::Marker>("graph_node", 10);
+  factor_pub_ =
+    node_.advertise<visualization_msgs::Marker>("graph_factor", 10);
+  landmark_pub_ =
+    node_.advertise<visualization_msgs::Marker>("graph_landmark", 10);
+  pose_pub_ = node_.advertise<geometry_msgs::PoseStamped>("pose", 10);
+  // private like its parameters, ~save_map or ~<robot>/save_map
+  ros::NodeHandle private_node(robot_.empty() ? "~" : "~" + robot_);
+  save_map_srv_ =
+    private_node.advertiseService("save_map", &SlamNode::SaveMap, this);
+
+  map_outputs_.resize(1);
+  map_outputs_[0].map_pub =
+    node_.advertise<nav_msgs::OccupancyGrid>("map", 1, true);
+  map_outputs_[0].update_pub =
+    node_.advertise<map_msgs::OccupancyGridUpdate>("map_updates", 10);
+  // a coarser map per pyramid factor, e.g. map_x4 at 4x the resolution
+  for (size_t k = 0; k < pyramid_factors_.size(); k++) {
+    if (pyramid_factors_[k] < 2) {
+      ROS_WARN("ignore pyramid factor %d", pyramid_factors_[k]);
+      pyramid_factors_.erase(pyramid_factors_.begin() + k--);
+      continue;
+    }
+    std::string topic = "map_x" + std::to_string(pyramid_factors_[k]);
+    MapOutput output;
+    output.map_pub = node_.advertise<nav_msgs::OccupancyGrid>(topic, 1, true);
+    output.update_pub =
+      node_.advertise<map_msgs::OccupancyGridUpdate>(topic + "_updates", 10);
+    map_outputs_.push_back(output);
+  }
+  pyramid_.resize(pyramid_factors_.size());
+
+  if (graph_rate_ > 0.0) {
+    graph_timer_ = node_.createTimer(ros::Duration(1.0 / graph_rate_),
+        [this](const ros::TimerEvent &) { RequestRender(false, true); });
+  }
+  if (pose_rate_ > 0.0) {
+    pose_timer_ = node_.createTimer(ros::Duration(1.0 / pose_rate_),
+        &SlamNode::PublishPose, this);
+  }
+
+  // starts from the parameters as read, robot overrides included
+  reconfigure_.reset(
+      new dynamic_reconfigure::Server<PGSlamConfig>(private_node));
+  reconfigure_->updateConfig(params_);
+  reconfigure_->setCallback([this](PGSlamConfig &params, uint32_t level) {
+    Reconfigure(params, level);
+  });
+}
+
+void SlamNode::ScanCallback(const sensor_msgs::LaserScanConstPtr &msg,
+    size_t lidar) {
+  // the other lidars wait for the next scan of the first one, which takes
+  // the latest of each along if it is close enough in time
+  std::vector<sensor_msgs::LaserScanConstPtr> msgs(1, msg);
+  bool post;
+  {
+    std::lock_guard<std::mutex> lock(scans_mutex_);
+    if (lidar > 0) {
+      latest_scans_[lidar] = msg;
+      return;
+    }
+    for (size_t k = 1; k < latest_scans_.size(); k++) {
+      if (!latest_scans_[k]) continue;
+      ros::Duration lag = msg->header.stamp - latest_scans_[k]->header.stamp;
+      if (fabs(lag.toSec()) > fusion_window_) continue;
+      msgs.push_back(latest_scans_[k]);
+      latest_scans_[k].reset();
+    }
+    // like a subscriber queue, a robot that falls behind drops its
+    // oldest scans and goes on with the recent ones
+    queued_scans_.push_back(msgs);
+    if (queued_scans_.size() > kScanQueueSize) {
+      queued_scans_.pop_front();
+      ROS_WARN_THROTTLE(1.0, "slam %s falls behind, drop scan",
+          robot_.c_str());
+    }
+    post = !scans_posted_;
+    scans_posted_ = true;
+  }
+  if (post) slam_strand_.Post([this]() { ProcessScans(); });
+}
+
+// a scan that came before its odometry stays queued, without holding a
+// worker of the pool, and is tried again with the next scan
+void SlamNode::ProcessScans() {
+  std::vector<sensor_msgs::LaserScanConstPtr> msgs;
+  {
+    std::lock_guard<std::mutex> lock(scans_mutex_);
+    if (queued_scans_.empty()) {
+      scans_posted_ = false;
+      return;
+    }
+    msgs = queued_scans_.front();
+    queued_scans_.pop_front();
+  }
+
+  // odometry where the scan was taken, the correction is stamped there
+  ros::Time stamp = msgs[0]->header.stamp;
+  Pose2D odom_new;
+  bool found = ListenPose2D(odom_frame_, base_frame_, stamp, &odom_new);
+  bool late = ros::Time::now() - stamp > ros::Duration(kOdometryTimeout);
+  if (!found && !late) {
+    std::lock_guard<std::mutex> lock(scans_mutex_);
+    if (queued_scans_.size() < kScanQueueSize)
+      queued_scans_.push_front(msgs);
+    scans_posted_ = false;
+    return;
+  }
+  if (found) {
+    ProcessScan(msgs, odom_new);
+  } else {
+    ROS_WARN_THROTTLE(1.0, "no odometry at the scan for slam %s, drop scan",
+        robot_.c_str());
+  }
+
+  bool more;
+  {
+    std::lock_guard<std::mutex> lock(scans_mutex_);
+    more = !queued_scans_.empty();
+    scans_posted_ = more;
+  }
+  if (more) slam_strand_.Post([this]() { ProcessScans(); });
+}
+
+void SlamNode::ProcessScan(
+    const std::vector<sensor_msgs::LaserScanConstPtr> &msgs,
+    Pose2D odom_new) {
+  const sensor_msgs::LaserScan &msg = *msgs[0];
+  // a reconfigured slam applies from this scan on
+  auto config = this->config();
+  if (config != slam_config_) {
+    slam_.set_config(config->slam);
+    slam_config_ = config;
+  }
+
+  // one match for all lidars, each moved to where it was at the time of
+  // the first one by the odometry in between
+  std::vector<std::vector<Echo>> echos;
+  std::vector<Pose2D> mounts;
+  for (size_t k = 0; k < msgs.size(); k++) {
+    Pose2D mount;  // the scan topic alone is at the origin of the base
+    if (!scan_topics_.empty() &&
+        !LidarMount(msgs[k]->header.frame_id, &mount)) {
+      ROS_WARN_THROTTLE(1.0, "no mount of lidar %s for slam %s",
+          msgs[k]->header.frame_id.c_str(), robot_.c_str());
+      if (k == 0) return;
+      continue;
+    }
+    Pose2D odom;
+    if (k > 0 && ListenPose2D(odom_frame_, base_frame_,
+          msgs[k]->header.stamp, &odom))
+      mount = mount * (odom * odom_new.inverse());
+    echos.push_back(RosLaserScan_T_Echos(*msgs[k]));
+    mounts.push_back(mount);
+  }
+
+  Pose2D odom_delta = odom_new * odom_old_.inverse();
+  odom_old_ = odom_new;
+  scan_stamp_ = msg.header.stamp;
+  slam_.UpdatePoseWithPose(odom_delta);
+  slam_.UpdatePoseWithLaserScan(LaserScan(echos, mounts,
+        msg.header.stamp.toNSec()));
+}
+
+bool SlamNode::LidarMount(const std::string &frame, Pose2D *mount) {
+  auto found = mounts_.find(frame);
+  if (found != mounts_.end()) {
+    *mount = found->second;
+    return true;
+  }
+  if (frame != base_frame_ && !ListenPose2D(base_frame_, frame,
+        ros::Time(0), mount))
+    return false;
+  mounts_[frame] = *mount;
+  return true;
+}
+
+bool SlamNode::ListenPose2D(const std::string &target_frame,
+    const std::string &source_frame, ros::Time stamp, Pose2D *pose) {
+  // listen
+  tf::StampedTransform transform;
+  try {
+    listener_->lookupTransform(target_frame,
+        source_frame, stamp, transform);
+  } catch (tf::TransformException ex) {
+    ROS_DEBUG("slam lookupTransform error: %s", ex.what());
+    return false;
+  }
+
+  // calc pose
+  pose->set_x(transform.getOrigin().x());
+  pose->set_y(transform.getOrigin().y());
+
+  double roll, pitch, yaw;
+  transform.getBasis().getRPY(roll, pitch, yaw);
+
+  pose->set_theta(yaw);
+
+  return true;
+}
+
+// called on the slam strand, where odom_old_ is the odometry of the
+// pose. the correction holds until the next scan
+void SlamNode::BroadcastPose(Pose2D pose) {
+  Pose2D correction = odom_old_.inverse() * pose;
+  // the pose timer may have sent the old correction past the scan
+  // already, tf would keep it there, so the new one goes no earlier
+  std::lock_guard<std::mutex> lock(correction_mutex_);
+  correction_ = correction;
+  correction_stamp_ = scan_stamp_;
+  correction_sent_ = std::max(correction_sent_, scan_stamp_);
+  SendCorrection(correction, correction_sent_);
+}
+
+void SlamNode::PublishPose(const ros::TimerEvent &event) {
+  tf::StampedTransform transform;
+  try {
+    listener_->lookupTransform(odom_frame_, base_frame_, ros::Time(0),
+        transform);
+  } catch (tf::TransformException ex) {
+    return;
+  }
+  Pose2D correction;
+  {
+    // odometry older than the correction is already in it, and the same
+    // odometry is published once
+    std::lock_guard<std::mutex> lock(correction_mutex_);
+    if (correction_stamp_.isZero() || transform.stamp_ <= correction_stamp_ ||
+        transform.stamp_ <= correction_sent_)
+      return;
+    correction = correction_;
+    // map to odom at the odometry time, so map to base looks up up to
+    // now. sent under the lock, a new correction never goes before it
+    correction_sent_ = transform.stamp_;
+    SendCorrection(correction, correction_sent_);
+  }
+
+  double roll, pitch, yaw;
+  transform.getBasis().getRPY(roll, pitch, yaw);
+  Pose2D odom(transform.getOrigin().x(), transform.getOrigin().y(), yaw);
+  Pose2D pose = odom * correction;
+
+  geometry_msgs::PoseStamped msg;
+  msg.header.stamp = transform.stamp_;
+  msg.header.frame_id = map_frame_;
+  msg.pose.position.x = pose.x();
+  msg.pose.position.y = pose.y();
+  msg.pose.orientation.z = sin(pose.theta() / 2);
+  msg.pose.orientation.w = cos(pose.theta() / 2);
+  pose_pub_.publish(msg);
+}
+
+void SlamNode::SendCorrection(Pose2D correction, ros::Time stamp) {
+  tf::StampedTransform transform;
+  transform.setOrigin(tf::Vector3(correction.pos().x(),
+        correction.pos().y(), 0.0));
+  tf::Quaternion q;
+  q.setRPY(0, 0, correction.theta());
+  transform.setRotation(q);
+
+  broadcaster_.sendTransform(tf::StampedTransform(transform,
+        stamp, map_frame_, odom_frame_));
+}
+
+void SlamNode::RequestRender(bool map, bool graph) {
+  bool post;
+  {
+    std::lock_guard<std::mutex> lock(render_mutex_);
+    map_dirty_ = map_dirty_ || map;
+    graph_dirty_ = graph_dirty_ || graph;
+    post = !render_queued_;
+    render_queued_ = true;
+  }
+  if (post) render_strand_.Post([this]() { Render(); });
+}
+
+void SlamNode::Render() {
+  bool map;
+  bool graph;
+  {
+    std::lock_guard<std::mutex> lock(render_mutex_);
+    map = map_dirty_;
+    graph = graph_dirty_;
+    map_dirty_ = false;
+    graph_dirty_ = false;
+    render_queued_ = false;
+  }
+  // slam goes on while this snapshot is drawn
+  auto snapshot = slam_.snapshot();
+  auto config = this->config();
+  if (graph) DrawGraph(*snapshot, *config);
+  if (map) DrawMap(*snapshot, *config);
+}
+
+// marker chunks are only republished when they grew or moved
+void SlamNode::PublishChunks(const std::vector<geometry_msgs::Point> &points,
+    visualization_msgs::Marker marker, const ros::Publisher &pub,
+    double tolerance, std::vector<geometry_msgs::Point> *published) const {
+  for (size_t begin = 0; begin < points.size(); begin += kMarkerChunk) {
+    size_t end = std::min(points.size(), begin + kMarkerChunk);
+    bool changed = published->size() < end;
+    for (size_t i = begin; !changed && i < end; i++) {
+      changed = std::hypot(points[i].x - (*published)[i].x,
+          points[i].y - (*published)[i].y) > tolerance;
+    }
+    if (!changed) continue;
+    marker.id = begin / kMarkerChunk;
+    marker.points.assign(points.begin() + begin, points.begin() + end);
+    pub.publish(marker);
+    if (published->size() < end) published->resize(end);
+    std::copy(points.begin() + begin, points.begin() + end,
+        published->begin() + begin);
+  }
+
+  // chunks left over after nodes were removed
+  size_t chunks = (points.size() + kMarkerChunk - 1) / kMarkerChunk;
+  size_t published_chunks =
+    (published->size() + kMarkerChunk - 1) / kMarkerChunk;
+  marker.action = visualization_msgs::Marker::DELETE;
+  marker.points.clear();
+  for (size_t k = chunks; k < published_chunks; k++) {
+    marker.id = k;
+    pub.publish(marker);
+  }
+  if (published->size() > points.size()) published->resize(points.size());
+}
+
+void SlamNode::DrawGraph(const SlamSnapshot &snapshot,
+    const Config &config) {
+  visualization_msgs::Marker points;
+  points.header.frame_id = map_frame_;
+  points.header.stamp = ros::Time::now();
+  points.ns = "graph_nodes";
+  points.action = visualization_msgs::Marker::ADD;
+  points.pose.orientation.w = 1.0;
+  points.type = visualization_msgs::Marker::POINTS;
+  points.scale.x = 0.05;
+  points.scale.y = 0.05;
+  points.color.g = 0.5f;
+  points.color.a = 1.0;
+
+  const LaserScanHandles &scans = *snapshot.scans;
+  std::vector<geometry_msgs::Point> nodes(scans.size());
+  for (size_t i = 0; i < scans.size(); i++) {
+    nodes[i].x = scans[i]->pose().pos().x();
+    nodes[i].y = scans[i]->pose().pos().y();
+  }
+  PublishChunks(nodes, points, node_pub_, config.graph_tolerance,
+      &published_nodes_);
+
+  visualization_msgs::Marker line_list;
+  line_list.header.frame_id = map_frame_;
+  line_list.header.stamp = ros::Time::now();
+  line_list.ns = "graph_factors";
+  line_list.action = visualization_msgs::Marker::ADD;
+  line_list.pose.orientation.w = 1.0;
+  line_list.type = visualization_msgs::Marker::LINE_LIST;
+  line_list.scale.x = 0.01;
+  line_list.color.r = 0.5;
+  line_list.color.a = 1.0;
+
+  const auto &graph_nodes = *snapshot.graph_nodes;
+  const auto &graph_edges = *snapshot.graph_edges;
+  std::vector<geometry_msgs::Point> positions;
+  std::vector<bool> present;
+  for (size_t i = 0; i < graph_nodes.size(); i++) {
+    size_t id = graph_nodes[i].first;
+    if (positions.size() <= id) {
+      positions.resize(id + 1);
+      present.resize(id + 1, false);
+    }
+    positions[id].x = graph_nodes[i].second.x();
+    positions[id].y = graph_nodes[i].second.y();
+    present[id] = true;
+  }
+  std::vector<geometry_msgs::Point> lines;
+  lines.reserve(graph_edges.size() * 2);
+  for (size_t i = 0; i < graph_edges.size(); i++) {
+    size_t first = graph_edges[i].first;
+    size_t second = graph_edges[i].second;
+    if (std::max(first, second) >= present.size() ||
+        !present[first] || !present[second]) continue;
+    lines.push_back(positions[first]);
+    lines.push_back(positions[second]);
+  }
+
+  // landmarks with a line to every key scan that saw them
+  const auto &graph_landmarks = *snapshot.landmarks;
+  const auto &landmark_edges = *snapshot.landmark_edges;
+  std::vector<geometry_msgs::Point> landmarks(graph_landmarks.size());
+  for (size_t i = 0; i < graph_landmarks.size(); i++) {
+    landmarks[i].x = graph_landmarks[i].x();
+    landmarks[i].y = graph_landmarks[i].y();
+  }
+  for (size_t i = 0; i < landmark_edges.size(); i++) {
+    size_t node = landmark_edges[i].first;
+    size_t landmark = landmark_edges[i].second;
+    if (node >= present.size() || !present[node] ||
+        landmark >= landmarks.size()) continue;
+    lines.push_back(positions[node]);
+    lines.push_back(landmarks[landmark]);
+  }
+  PublishChunks(lines, line_list, factor_pub_, config.graph_tolerance,
+      &published_factors_);
+
+  points.ns = "graph_landmarks";
+  points.scale.x = 0.1;
+  points.scale.y = 0.1;
+  points.color.g = 0.0f;
+  points.color.b = 1.0f;
+  PublishChunks(landmarks, points, landmark_pub_, config.graph_tolerance,
+      &published_landmarks_);
+}
+
+void SlamNode::PublishMap(const GridMap &map, double full_map_interval,
+    MapOutput *output) const {
+  // a full map when the geometry changed or the last one is too old
+  ros::Time now = ros::Time::now();
+  int box[4];
+  bool full = !ChangedBox(map, output->map, box) ||
+    (now - output->last_full_map).toSec() >= full_map_interval;
+
+  // otherwise only the bounding box of the cells that changed, unless it
+  // covers most of the map and is not worth the update message
+  int width = map.width();
+  int update_width = box[2] - box[0] + 1;
+  int update_height = box[3] - box[1] + 1;
+  if (!full && box[2] >= 0 &&
+      2 * update_width * update_height > width * map.height())
+    full = true;
+
+  // copy map to ros map
+  nav_msgs::OccupancyGrid &grid = output->map;
+  grid.header.stamp = now;
+  grid.header.frame_id = map_frame_;
+  grid.info.resolution = map.resolution();
+  grid.info.map_load_time = now;
+
+  grid.info.width = width;
+  grid.info.height = map.height();
+
+  grid.info.origin.position.x = map.origin().x();
+  grid.info.origin.position.y = map.origin().y();
+  grid.info.origin.position.z = 0;
+  grid.info.origin.orientation.w = 1.0;
+
+  grid.data.assign(map.data().begin(), map.data().end());
+
+  // publish
+  if (full) {
+    output->map_pub.publish(grid);
+    output->last_full_map = now;
+    return;
+  }
+  if (box[2] < 0) return;  // nothing changed
+
+  map_msgs::OccupancyGridUpdate update;
+  update.header = grid.header;
+  update.x = box[0];
+  update.y = box[1];
+  update.width = update_width;
+  update.height = update_height;
+  update.data.reserve(update_width * update_height);
+  for (int y = box[1]; y <= box[3]; y++) {
+    auto row = grid.data.begin() + static_cast<size_t>(y) * width;
+    update.data.insert(update.data.end(), row + box[0], row + box[2] + 1);
+  }
+  output->update_pub.publish(update);
+}
+
+// draw finished submaps as cached tiles_ and the rest scan by scan. scans
+// whose rays cannot reach the map, e.g. a band of an export, are skipped
+void SlamNode::RenderMap(const SlamSnapshot &snapshot, GridMap *map,
+    double draw_range) {
+  double resolution = map->resolution();
+  const LaserScanHandles &scans = *snapshot.scans;
+  const SubmapHandles &submaps = *snapshot.submaps;
+  std::vector<bool> drawn(scans.size(), false);
+  if (resolution != tile_resolution_ || draw_range != tile_draw_range_) {
+    tiles_.clear();
+    tile_resolution_ = resolution;
+    tile_draw_range_ = draw_range;
+  }
+  for (size_t k = 0; k < submaps.size(); k++) {
+    if (!submaps[k]->finished()) continue;
+    if (tiles_.size() <= k) tiles_.resize(k + 1);
+    if (tiles_[k].width() == 0)
+      tiles_[k] = RenderSubmap(snapshot, *submaps[k], resolution,
+          draw_range);
+    map->Merge(tiles_[k], submaps[k]->pose());
+    for (auto &entry : submaps[k]->scans())
+      drawn[entry.first] = true;
+  }
+
+  Eigen::Vector2d reach(draw_range + 2 * resolution,
+      draw_range + 2 * resolution);
+  Eigen::Vector2d min = map->origin() - reach;
+  Eigen::Vector2d max = map->origin() + reach + resolution *
+    Eigen::Vector2d(map->width(), map->height());
+  for (size_t i = 0; i < scans.size(); i++) {  // for every scan
+    if (drawn[i]) continue;
+    Eigen::Vector2d pos = scans[i]->pose().pos();
+    if ((pos.array() < min.array()).any() ||
+        (pos.array() > max.array()).any()) continue;
+    LaserScan scan = snapshot.scan(i);
+    map->DrawScan(scan, scan.pose(), draw_range);
+  }
+}
+
+void SlamNode::DrawMap(const SlamSnapshot &snapshot, const Config &config) {
+  double resolution = config.resolution;
+  double draw_range = config.draw_range;
+
+  Eigen::Vector2d origin;
+  int width;
+  int height;
+  MapGeometry(snapshot, resolution, &origin, &width, &height);
+  ChunkGeometry(resolution, &origin, &width, &height);
+  GridMap map(resolution, origin, width, height);
+  RenderMap(snapshot, &map, draw_range);
+
+  // the pyramid follows the finest level, pooled only where it changed
+  int box[4];
+  bool resized = !ChangedBox(map, map_outputs_[0].map, box);
+  for (size_t k = 0; k < pyramid_.size(); k++) {
+    if (resized) {
+      pyramid_[k] = map.Downsample(pyramid_factors_[k]);
+    } else if (box[2] >= 0) {
+      pyramid_[k].Pool(map, pyramid_factors_[k], box[0], box[1], box[2],
+          box[3]);
+    }
+  }
+
+  PublishMap(map, config.full_map_interval, &map_outputs_[0]);
+  for (size_t k = 0; k < pyramid_.size(); k++)
+    PublishMap(pyramid_[k], config.full_map_interval, &map_outputs_[k + 1]);
+}
+
+// streams the map to ~map_file as pgm or png with a map_server yaml
+bool SlamNode::SaveMap(std_srvs::Trigger::Request &req,
+    std_srvs::Trigger::Response &res) {
+  auto config = this->config();
+  double resolution = config->resolution;
+  double draw_range = config->draw_range;
+  const std::string &map_file = config->map_file;
+  const std::string &map_format = config->map_format;
+
+  Eigen::Vector2d origin;
+  int width;
+  int height;
+  // every band is drawn from the same snapshot
+  auto snapshot = slam_.snapshot();
+  MapGeometry(*snapshot, resolution, &origin, &width, &height);
+  MapExporter exporter(resolution, origin, width, height);
+  MapFormat format = MapFormat::kPGM;
+  if (map_format == "png") {
+    format = MapFormat::kPNG;
+  } else if (map_format != "pgm") {
+    ROS_WARN("unknown map format %s, use pgm", map_format.c_str());
+  }
+  // the tile cache belongs to the render strand, so the export runs there
+  std::promise<bool> saved;
+  render_strand_.Post([&]() {
+    saved.set_value(exporter.Export(map_file, format,
+        [this, snapshot, draw_range](GridMap *band) {
+          RenderMap(*snapshot, band, draw_range);
+        }));
+  });
+  res.success = saved.get_future().get();
+  res.message = res.success ? "saved " + map_file : "cannot save " + map_file;
+  return true;
+}
+
+}  // namespace pgslam
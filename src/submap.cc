@@ -0,0 +1,85 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/submap.h>
+#include <pgslam/ndt2d.h>
+
+namespace pgslam {
+
+// cell size of the submap ndt grid
+const double kSubmapResolution = 0.5;
+
+Submap::Submap(Pose2D pose) {
+  pose_ = pose;
+  min_point_ = Eigen::Vector2d::Zero();
+  max_point_ = Eigen::Vector2d::Zero();
+  finished_ = false;
+}
+
+Pose2D Submap::pose() const {
+  return pose_;
+}
+
+void Submap::set_pose(Pose2D pose) {
+  pose_ = pose;
+}
+
+const std::vector<std::pair<size_t, Pose2D>> & Submap::scans() const {
+  return scans_;
+}
+
+size_t Submap::size() const {
+  return scans_.size();
+}
+
+void Submap::Insert(size_t scan_id, const LaserScan &scan,
+    Pose2D local_pose) {
+  scans_.push_back(std::make_pair(scan_id, local_pose));
+  const Eigen::Matrix2Xd &local = scan.local_points();
+  Eigen::Matrix2Xd points(2, points_.cols() + local.cols());
+  points << points_, local_pose.ToTransform() * local;
+  points_.swap(points);
+  for (long i = points_.cols() - local.cols(); i < points_.cols(); i++) {
+    if (!points_.col(i).allFinite()) continue;
+    min_point_ = min_point_.cwiseMin(points_.col(i));
+    max_point_ = max_point_.cwiseMax(points_.col(i));
+  }
+  grid_.reset();
+}
+
+void Submap::Finish() {
+  finished_ = true;
+  grid();
+  Eigen::Matrix2Xd().swap(points_);
+}
+
+bool Submap::finished() const {
+  return finished_;
+}
+
+const Eigen::Matrix2Xd & Submap::points() const {
+  return points_;
+}
+
+Eigen::Vector2d Submap::min_point() const {
+  return min_point_;
+}
+
+Eigen::Vector2d Submap::max_point() const {
+  return max_point_;
+}
+
+const NDTGrid & Submap::grid() const {
+  if (grid_) return *grid_;
+  std::shared_ptr<NDTGrid> grid(new NDTGrid(kSubmapResolution));
+  grid->Construct(points_);
+  grid_ = grid;
+  return *grid_;
+}
+
+MatchResult Submap::Match(const LaserScan &scan, Pose2D local_pose,
+    const MatchBudget &budget) const {
+  return grid().Match(scan.local_points(), local_pose, budget);
+}
+
+}  // namespace pgslam
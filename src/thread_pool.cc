@@ -0,0 +1,201 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/thread_pool.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace pgslam {
+
+namespace {
+
+// the pool and index of the worker running on this thread, if any
+thread_local const ThreadPool *current_pool = NULL;
+thread_local size_t current_worker = 0;
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t threads) {
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+  queued_ = 0;
+  running_ = 0;
+  next_ = 0;
+  stop_ = false;
+  for (size_t i = 0; i < threads; i++)
+    workers_.emplace_back(new Worker());
+  for (size_t i = 0; i < threads; i++)
+    threads_.emplace_back(&ThreadPool::Run, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (size_t i = 0; i < threads_.size(); i++)
+    threads_[i].join();
+}
+
+size_t ThreadPool::size() const {
+  return workers_.size();
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+  size_t index;
+  if (current_pool == this) {
+    index = current_worker;
+  } else {
+    std::lock_guard<std::mutex> lock(mutex_);
+    index = next_++ % workers_.size();
+  }
+  // counted before it is visible, so no worker takes more than counted
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_++;
+  }
+  {
+    std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+    workers_[index]->tasks.push_back(std::move(task));
+  }
+  wake_.notify_one();
+}
+
+void ThreadPool::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this]() { return queued_ == 0 && running_ == 0; });
+}
+
+void ThreadPool::ParallelFor(size_t count,
+    std::function<void(size_t)> body) {
+  if (count == 0) return;
+  // shared with helpers that may start after the caller has returned,
+  // they find nothing left and never touch the body
+  struct Loop {
+    std::function<void(size_t)> body;
+    size_t count;
+    std::atomic<size_t> next;
+    std::atomic<size_t> done;
+    std::mutex mutex;
+    std::condition_variable finished;
+  };
+  auto loop = std::make_shared<Loop>();
+  loop->body = std::move(body);
+  loop->count = count;
+  loop->next = 0;
+  loop->done = 0;
+  auto work = [loop]() {
+    size_t i;
+    while ((i = loop->next++) < loop->count) {
+      loop->body(i);
+      if (++loop->done == loop->count) {
+        std::lock_guard<std::mutex> lock(loop->mutex);
+        loop->finished.notify_all();
+      }
+    }
+  };
+  size_t helpers = std::min(count, workers_.size()) - 1;
+  for (size_t i = 0; i < helpers; i++)
+    Submit(work);
+  work();
+  std::unique_lock<std::mutex> lock(loop->mutex);
+  loop->finished.wait(lock, [&loop]() { return loop->done == loop->count; });
+}
+
+bool ThreadPool::Take(size_t index, std::function<void()> *task) {
+  // own newest task first, it is the most likely to be still in cache
+  {
+    Worker &worker = *workers_[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.tasks.empty()) {
+      *task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+      return true;
+    }
+  }
+  for (size_t k = 1; k < workers_.size(); k++) {
+    Worker &victim = *workers_[(index + k) % workers_.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      *task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::Run(size_t index) {
+  current_pool = this;
+  current_worker = index;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this]() { return queued_ > 0 || stop_; });
+      if (queued_ == 0) return;  // stopped and drained
+    }
+    std::function<void()> task;
+    // a counted task may not be pushed yet, or another worker took it
+    // and has not uncounted it, so look again
+    if (!Take(index, &task)) {
+      std::this_thread::yield();
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queued_--;
+      running_++;
+    }
+    task();
+    bool idle;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      running_--;
+      idle = queued_ == 0 && running_ == 0;
+    }
+    if (idle) idle_.notify_all();
+  }
+}
+
+Strand::Strand(ThreadPool *pool) {
+  pool_ = pool;
+  scheduled_ = false;
+}
+
+void Strand::Post(std::function<void()> task) {
+  bool schedule;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+    schedule = !scheduled_;
+    scheduled_ = true;
+  }
+  if (schedule) pool_->Submit([this]() { RunOne(); });
+}
+
+size_t Strand::pending() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return tasks_.size();
+}
+
+void Strand::RunOne() {
+  std::function<void()> task;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task = std::move(tasks_.front());
+  }
+  task();
+  // resubmitted instead of looping, so other strands get their turn
+  bool more;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.pop_front();
+    more = !tasks_.empty();
+    scheduled_ = more;
+  }
+  if (more) pool_->Submit([this]() { RunOne(); });
+}
+
+}  // namespace pgslam
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/evaluation.h>
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using pgslam::Pose2D;
+using pgslam::StampedPoses;
+
+// a quarter circle of radius 5, one pose every 10 cm
+std::vector<Pose2D> Arc() {
+  std::vector<Pose2D> poses;
+  for (int i = 0; i <= 78; i++) {
+    double angle = i * 0.02;
+    poses.push_back(Pose2D(5.0 * sin(angle), 5.0 - 5.0 * cos(angle),
+          angle));
+  }
+  return poses;
+}
+
+TEST(InterpolatePose, LinearBetweenPoses) {
+  StampedPoses poses;
+  poses.push_back(std::make_pair(100, Pose2D(0.0, 0.0, 0.0)));
+  poses.push_back(std::make_pair(200, Pose2D(1.0, 0.0, 0.2)));
+  Pose2D pose;
+  ASSERT_TRUE(pgslam::InterpolatePose(poses, 150, 1000, &pose));
+  EXPECT_NEAR(0.5, pose.x(), 0.01);
+  EXPECT_NEAR(0.1, pose.theta(), 1e-9);
+  ASSERT_TRUE(pgslam::InterpolatePose(poses, 200, 1000, &pose));
+  EXPECT_DOUBLE_EQ(1.0, pose.x());
+}
+
+TEST(InterpolatePose, FalseOutsideOrAcrossGaps) {
+  StampedPoses poses;
+  poses.push_back(std::make_pair(100, Pose2D()));
+  poses.push_back(std::make_pair(200, Pose2D(1.0, 0.0, 0.0)));
+  Pose2D pose;
+  EXPECT_FALSE(pgslam::InterpolatePose(poses, 50, 1000, &pose));
+  EXPECT_FALSE(pgslam::InterpolatePose(poses, 250, 1000, &pose));
+  EXPECT_FALSE(pgslam::InterpolatePose(poses, 150, 50, &pose));
+}
+
+TEST(EvaluateAbsolute, RigidOffsetIsAlignedAway) {
+  std::vector<Pose2D> truth = Arc();
+  // the estimate in another frame, e.g. started somewhere else
+  Pose2D offset(2.0, -1.0, 0.7);
+  std::vector<Pose2D> estimate;
+  for (const Pose2D &pose : truth)
+    estimate.push_back(pose * offset);
+  pgslam::AbsoluteError error = pgslam::EvaluateAbsolute(estimate, truth);
+  EXPECT_EQ(truth.size(), error.poses);
+  EXPECT_NEAR(0.0, error.rmse, 1e-6);
+  EXPECT_NEAR(0.0, error.max, 1e-6);
+  Pose2D aligned = estimate[10] * error.alignment;
+  EXPECT_NEAR(truth[10].x(), aligned.x(), 1e-6);
+  EXPECT_NEAR(truth[10].y(), aligned.y(), 1e-6);
+}
+
+TEST(EvaluateAbsolute, NoiseShowsUpInTheError) {
+  std::vector<Pose2D> truth = Arc();
+  std::vector<Pose2D> estimate = truth;
+  // every other pose 10 cm off to either side
+  for (size_t i = 0; i < estimate.size(); i++) {
+    double side = i % 2 == 0 ? 0.1 : -0.1;
+    estimate[i] = Pose2D(truth[i].x(), truth[i].y() + side,
+        truth[i].theta());
+  }
+  pgslam::AbsoluteError error = pgslam::EvaluateAbsolute(estimate, truth);
+  EXPECT_NEAR(0.1, error.rmse, 0.01);
+  EXPECT_LE(error.mean, error.rmse + 1e-12);
+  EXPECT_GE(error.max, error.rmse);
+}
+
+TEST(EvaluateRelative, ExactTrajectoryHasNoError) {
+  std::vector<Pose2D> truth = Arc();
+  pgslam::RelativeError error = pgslam::EvaluateRelative(truth, truth, 1.0);
+  EXPECT_GT(error.pairs, 0u);
+  EXPECT_DOUBLE_EQ(1.0, error.delta);
+  EXPECT_NEAR(0.0, error.translation_rmse, 1e-9);
+  EXPECT_NEAR(0.0, error.rotation_rmse, 1e-9);
+}
+
+TEST(EvaluateRelative, ScaledTrajectoryHasTranslationError) {
+  std::vector<Pose2D> truth = Arc();
+  std::vector<Pose2D> estimate;
+  for (const Pose2D &pose : truth)
+    estimate.push_back(Pose2D(1.1 * pose.x(), 1.1 * pose.y(), pose.theta()));
+  pgslam::RelativeError error =
+    pgslam::EvaluateRelative(estimate, truth, 1.0);
+  // about a tenth of every meter
+  EXPECT_NEAR(0.1, error.translation_rmse, 0.02);
+  EXPECT_NEAR(0.0, error.rotation_rmse, 1e-9);
+}
+
+}  // namespace
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/icp_engine.h>
+#include <pgslam/thread_pool.h>
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+namespace {
+
+using pgslam::Association;
+using pgslam::MatchBudget;
+using pgslam::MatchConfig;
+using pgslam::MatchResult;
+using pgslam::MatchStatus;
+using pgslam::Pose2D;
+using pgslam::Rejection;
+using pgslam::Solver;
+
+// walls of an l shaped room, 2 cm apart, no two sides alike
+Eigen::Matrix2Xd Room() {
+  const double corners[][2] = {{-2.0, -1.5}, {3.0, -1.5}, {3.0, 0.5},
+    {1.0, 0.5}, {1.0, 2.5}, {-2.0, 2.5}, {-2.0, -1.5}};
+  std::vector<Eigen::Vector2d> points;
+  for (int k = 0; k + 1 < 7; k++) {
+    Eigen::Vector2d from(corners[k][0], corners[k][1]);
+    Eigen::Vector2d to(corners[k + 1][0], corners[k + 1][1]);
+    int steps = static_cast<int>((to - from).norm() / 0.02);
+    for (int i = 0; i < steps; i++)
+      points.push_back(from + (to - from) * i / steps);
+  }
+  Eigen::Matrix2Xd room(2, points.size());
+  for (size_t i = 0; i < points.size(); i++)
+    room.col(i) = points[i];
+  return room;
+}
+
+// the room seen from pose, in the frame of pose
+Eigen::Matrix2Xd Seen(const Eigen::Matrix2Xd &room, Pose2D pose) {
+  return pose.ToTransform().inverse() * room;
+}
+
+MatchResult MatchRoom(Association association, const MatchConfig &config,
+    pgslam::ThreadPool *pool, Pose2D truth) {
+  Eigen::Matrix2Xd room = Room();
+  pgslam::icp::Geometry geometry = {0.0, 0.0, 1, pool};
+  return pgslam::icp::Match<double>(association, config, geometry, room,
+      Seen(room, truth), Pose2D(), MatchBudget());
+}
+
+void ExpectPose(Pose2D expected, Pose2D actual, double tolerance) {
+  EXPECT_NEAR(expected.x(), actual.x(), tolerance);
+  EXPECT_NEAR(expected.y(), actual.y(), tolerance);
+  EXPECT_NEAR(expected.theta(), actual.theta(), tolerance);
+}
+
+TEST(IcpEngine, EveryAssociationRecoversTheOffset) {
+  Pose2D truth(0.08, -0.05, 0.03);
+  Association associations[] = {Association::kAuto,
+    Association::kBruteForce, Association::kGrid, Association::kKDTree};
+  // point to line fits the walls exactly, whatever the sampling
+  MatchConfig config;
+  config.solver = Solver::kPointToLine;
+  for (Association association : associations) {
+    SCOPED_TRACE(static_cast<int>(association));
+    MatchResult result = MatchRoom(association, config, nullptr, truth);
+    EXPECT_EQ(MatchStatus::kConverged, result.status);
+    EXPECT_GT(result.ratio, 0.9);
+    ExpectPose(truth, result.pose, 0.001);
+  }
+}
+
+TEST(IcpEngine, EverySolverAndRejectionRecoversTheOffset) {
+  Pose2D truth(-0.06, 0.04, -0.02);
+  Solver solvers[] = {Solver::kHeuristic, Solver::kSVD,
+    Solver::kPointToLine};
+  Rejection rejections[] = {Rejection::kTrim, Rejection::kRobust,
+    Rejection::kDuplicate};
+  for (Solver solver : solvers) {
+    for (Rejection rejection : rejections) {
+      SCOPED_TRACE(static_cast<int>(solver) * 10 +
+          static_cast<int>(rejection));
+      MatchConfig config;
+      config.solver = solver;
+      config.rejection = rejection;
+      MatchResult result = MatchRoom(Association::kKDTree, config, nullptr,
+          truth);
+      // point to point pairs are biased by the 2 cm sampling
+      ExpectPose(truth, result.pose, 0.01);
+    }
+  }
+}
+
+TEST(IcpEngine, ThreadsDoNotChangeTheResult) {
+  Pose2D truth(0.05, 0.05, 0.02);
+  MatchConfig config;
+  config.parallel_points = 1;
+  MatchResult serial = MatchRoom(Association::kKDTree, config, nullptr,
+      truth);
+  pgslam::ThreadPool pool(4);
+  MatchResult parallel = MatchRoom(Association::kKDTree, config, &pool,
+      truth);
+  EXPECT_EQ(serial.iterations, parallel.iterations);
+  EXPECT_DOUBLE_EQ(serial.pose.x(), parallel.pose.x());
+  EXPECT_DOUBLE_EQ(serial.pose.y(), parallel.pose.y());
+  EXPECT_DOUBLE_EQ(serial.pose.theta(), parallel.pose.theta());
+}
+
+TEST(IcpEngine, EmptyQueryDiverges) {
+  Eigen::Matrix2Xd room = Room();
+  pgslam::icp::Geometry geometry = {0.0, 0.0, 1, nullptr};
+  MatchResult result = pgslam::icp::Match<double>(Association::kKDTree,
+      MatchConfig(), geometry, room, Eigen::Matrix2Xd(2, 0), Pose2D(),
+      MatchBudget());
+  EXPECT_EQ(MatchStatus::kDiverged, result.status);
+}
+
+TEST(IcpEngine, IterationBudgetIsKept) {
+  MatchBudget budget;
+  budget.max_iterations = 2;
+  Eigen::Matrix2Xd room = Room();
+  pgslam::icp::Geometry geometry = {0.0, 0.0, 1, nullptr};
+  MatchResult result = pgslam::icp::Match<double>(Association::kKDTree,
+      MatchConfig(), geometry, room, Seen(room, Pose2D(0.2, 0.0, 0.0)),
+      Pose2D(), budget);
+  EXPECT_EQ(MatchStatus::kBudgetExhausted, result.status);
+  EXPECT_LE(result.iterations, 2);
+}
+
+}  // namespace
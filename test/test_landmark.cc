@@ -0,0 +1,128 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/landmark.h>
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+namespace {
+
+using pgslam::Echo;
+using pgslam::LandmarkConfig;
+using pgslam::LaserScan;
+using pgslam::Pose2D;
+
+const double kBeamAngle = M_PI / 180.0;
+
+// a full turn of beams, 4 m to a dull wall unless set otherwise
+struct Beams {
+  Beams() : range(360, 4.0), intensity(360, 10.0) {}
+  LaserScan scan() const {
+    std::vector<Echo> echos;
+    for (size_t i = 0; i < range.size(); i++)
+      echos.push_back(Echo(range[i], -M_PI + i * kBeamAngle, intensity[i],
+            0));
+    return LaserScan(echos);
+  }
+  std::vector<double> range;
+  std::vector<double> intensity;
+};
+
+LandmarkConfig Config() {
+  LandmarkConfig config;
+  config.intensity = 500.0;
+  config.min_points = 2;
+  config.max_size = 0.15;
+  return config;
+}
+
+TEST(ExtractReflectors, FindsTheCenterOfABrightRun) {
+  Beams beams;
+  // a marker 2 m ahead, hit by three beams around angle 0
+  for (int i = 179; i <= 181; i++) {
+    beams.range[i] = 2.0;
+    beams.intensity[i] = 1000.0;
+  }
+  std::vector<Eigen::Vector2d> reflectors =
+    pgslam::ExtractReflectors(beams.scan(), Config());
+  ASSERT_EQ(1u, reflectors.size());
+  EXPECT_NEAR(2.0, reflectors[0].x(), 0.01);
+  EXPECT_NEAR(0.0, reflectors[0].y(), 0.01);
+}
+
+TEST(ExtractReflectors, BackOnceARestoredScan) {
+  Beams beams;
+  for (int i = 179; i <= 181; i++) {
+    beams.range[i] = 2.0;
+    beams.intensity[i] = 1000.0;
+  }
+  LaserScan scan = beams.scan();
+  Eigen::Matrix2Xd points = scan.local_points();
+  scan.Release();
+  EXPECT_TRUE(pgslam::ExtractReflectors(scan, Config()).empty());
+  scan.Restore(points);
+  EXPECT_EQ(1u, pgslam::ExtractReflectors(scan, Config()).size());
+}
+
+TEST(ExtractReflectors, LeavesOutBrightWallsAndSingleBeams) {
+  Beams beams;
+  // a bright wall, far wider than a marker
+  for (int i = 40; i <= 80; i++)
+    beams.intensity[i] = 1000.0;
+  // one bright beam is below min_points
+  beams.intensity[270] = 1000.0;
+  EXPECT_TRUE(pgslam::ExtractReflectors(beams.scan(), Config()).empty());
+}
+
+TEST(ExtractReflectors, NoneWithoutAnIntensityThreshold) {
+  Beams beams;
+  for (int i = 179; i <= 181; i++)
+    beams.intensity[i] = 1000.0;
+  LandmarkConfig config = Config();
+  config.intensity = 0.0;
+  EXPECT_TRUE(pgslam::ExtractReflectors(beams.scan(), config).empty());
+}
+
+TEST(ExtractReflectors, JoinsAMarkerSplitByTheSeam) {
+  Beams beams;
+  // the first and the last beams both look straight back
+  for (int i : {358, 359, 0, 1}) {
+    beams.range[i] = 2.0;
+    beams.intensity[i] = 1000.0;
+  }
+  std::vector<Eigen::Vector2d> reflectors =
+    pgslam::ExtractReflectors(beams.scan(), Config());
+  ASSERT_EQ(1u, reflectors.size());
+  EXPECT_NEAR(-2.0, reflectors[0].x(), 0.01);
+}
+
+TEST(AssociateReflectors, ClosestLandmarkWithinTheGate) {
+  std::vector<Eigen::Vector2d> landmarks = {Eigen::Vector2d(3.0, 1.0),
+    Eigen::Vector2d(3.0, 1.3), Eigen::Vector2d(-5.0, 0.0)};
+  // seen from a robot at (1, 1) facing +y
+  Pose2D pose(1.0, 1.0, M_PI_2);
+  std::vector<Eigen::Vector2d> reflectors = {Eigen::Vector2d(0.25, -2.0),
+    Eigen::Vector2d(5.0, 5.0)};
+  std::vector<int> associations =
+    pgslam::AssociateReflectors(reflectors, pose, landmarks, 0.5);
+  ASSERT_EQ(2u, associations.size());
+  EXPECT_EQ(1, associations[0]);
+  EXPECT_EQ(-1, associations[1]);
+}
+
+TEST(AssociateReflectors, EveryLandmarkTakenOnce) {
+  std::vector<Eigen::Vector2d> landmarks = {Eigen::Vector2d(1.0, 0.0)};
+  std::vector<Eigen::Vector2d> reflectors = {Eigen::Vector2d(1.2, 0.0),
+    Eigen::Vector2d(1.05, 0.0)};
+  std::vector<int> associations =
+    pgslam::AssociateReflectors(reflectors, Pose2D(), landmarks, 0.5);
+  ASSERT_EQ(2u, associations.size());
+  // the closer reflector wins, the other one is a new landmark
+  EXPECT_EQ(-1, associations[0]);
+  EXPECT_EQ(0, associations[1]);
+}
+
+}  // namespace
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/nn_search.h>
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <random>
+
+namespace {
+
+Eigen::Matrix2Xd RandomPoints(size_t count, double extent,
+    std::mt19937 *random) {
+  std::uniform_real_distribution<double> uniform(-extent, extent);
+  Eigen::Matrix2Xd points(2, count);
+  for (size_t i = 0; i < count; i++)
+    points.col(i) = Eigen::Vector2d(uniform(*random), uniform(*random));
+  return points;
+}
+
+// the closest point within the gate, by a plain loop
+size_t Nearest(const Eigen::Matrix2Xd &points, const Eigen::Vector2d &point,
+    double gate) {
+  size_t best = nn_search::kNoMatch;
+  double best_dist = gate;
+  for (long i = 0; i < points.cols(); i++) {
+    double dist = (points.col(i) - point).norm();
+    if (dist < best_dist) {
+      best_dist = dist;
+      best = i;
+    }
+  }
+  return best;
+}
+
+TEST(NearestSearch, BackendsFindTheClosestPoint) {
+  std::mt19937 random(1);
+  Eigen::Matrix2Xd points = RandomPoints(500, 5.0, &random);
+  Eigen::Matrix2Xd queries = RandomPoints(200, 5.0, &random);
+  // wider than the cloud, so every query has a match
+  const double gate = 20.0;
+  nn_search::Backend backends[] = {nn_search::Backend::kBruteForce,
+    nn_search::Backend::kGrid, nn_search::Backend::kKDTree};
+  for (nn_search::Backend backend : backends) {
+    auto search = nn_search::Create<double>(backend, gate);
+    search->Construct(points);
+    for (long i = 0; i < queries.cols(); i++) {
+      Eigen::Vector2d query = queries.col(i);
+      EXPECT_EQ(Nearest(points, query, gate), search->NearestIndex(query))
+        << "backend " << static_cast<int>(backend) << ", query " << i;
+    }
+  }
+}
+
+TEST(NearestSearch, GridLeavesPointsBeyondTheGate) {
+  Eigen::Matrix2Xd points(2, 2);
+  points << 0.0, 10.0,
+            0.0, 0.0;
+  nn_search::GridSearch<double> search(0.5);
+  search.Construct(points);
+  EXPECT_EQ(0u, search.NearestIndex(Eigen::Vector2d(0.3, 0.0)));
+  EXPECT_EQ(1u, search.NearestIndex(Eigen::Vector2d(9.8, 0.1)));
+  EXPECT_EQ(nn_search::kNoMatch,
+      search.NearestIndex(Eigen::Vector2d(5.0, 0.0)));
+}
+
+TEST(NearestSearch, GridSkipsNonFinitePoints) {
+  double inf = std::numeric_limits<double>::infinity();
+  Eigen::Matrix2Xd points(2, 4);
+  points << 1.0, inf, std::nan(""), 2.0,
+            1.0, 0.0, 0.0, 2.0;
+  nn_search::GridSearch<double> search(1.0);
+  search.Construct(points);
+  // indices still refer to the cloud as given
+  EXPECT_EQ(0u, search.NearestIndex(Eigen::Vector2d(1.1, 1.0)));
+  EXPECT_EQ(3u, search.NearestIndex(Eigen::Vector2d(2.0, 1.9)));
+}
+
+TEST(NearestSearch, GridCellCountIsBounded) {
+  Eigen::Matrix2Xd points(2, 2);
+  points << -1e9, 1e9,
+            -1e9, 1e9;
+  // too many cells for auto to pick the grid
+  EXPECT_EQ(static_cast<size_t>(-1),
+      nn_search::GridSearch<double>::CellCount(points, 0.1));
+  // a forced one gets coarser cells
+  nn_search::GridSearch<double> search(0.1);
+  search.Construct(points);
+  EXPECT_EQ(1u, search.NearestIndex(Eigen::Vector2d(1e9, 1e9)));
+}
+
+TEST(NearestSearch, EmptyCloudHasNoMatch) {
+  Eigen::Matrix2Xd points(2, 0);
+  nn_search::Backend backends[] = {nn_search::Backend::kBruteForce,
+    nn_search::Backend::kGrid};
+  for (nn_search::Backend backend : backends) {
+    auto search = nn_search::Create<double>(backend, 1.0);
+    search->Construct(points);
+    EXPECT_EQ(nn_search::kNoMatch,
+        search->NearestIndex(Eigen::Vector2d(0.0, 0.0)));
+  }
+}
+
+}  // namespace
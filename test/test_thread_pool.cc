@@ -0,0 +1,82 @@
+/*
+ * Copyright 2017 Yu Kunlin <yukunlin@mail.ustc.edu.cn>
+ */
+#include <pgslam/thread_pool.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <vector>
+
+namespace {
+
+using pgslam::Strand;
+using pgslam::ThreadPool;
+
+TEST(ThreadPool, RunsEverySubmittedTask) {
+  ThreadPool pool(4);
+  EXPECT_EQ(4u, pool.size());
+  std::atomic<int> count(0);
+  for (int i = 0; i < 1000; i++)
+    pool.Submit([&count]() { count++; });
+  pool.Wait();
+  EXPECT_EQ(1000, count.load());
+}
+
+TEST(ThreadPool, AsyncReturnsTheResult) {
+  ThreadPool pool(2);
+  std::future<int> result = pool.Async([]() { return 6 * 7; });
+  EXPECT_EQ(42, result.get());
+}
+
+TEST(ThreadPool, ParallelForVisitsEveryIndexOnce) {
+  ThreadPool pool(3);
+  std::vector<std::atomic<int>> visits(257);
+  for (auto &visit : visits) visit = 0;
+  pool.ParallelFor(visits.size(), [&visits](size_t i) { visits[i]++; });
+  for (size_t i = 0; i < visits.size(); i++)
+    EXPECT_EQ(1, visits[i].load()) << "index " << i;
+}
+
+TEST(ThreadPool, NestedParallelForDoesNotDeadlock) {
+  // every worker blocks in an outer body, the inner loops still finish
+  ThreadPool pool(2);
+  std::atomic<int> count(0);
+  pool.ParallelFor(4, [&pool, &count](size_t) {
+    pool.ParallelFor(8, [&count](size_t) { count++; });
+  });
+  EXPECT_EQ(32, count.load());
+}
+
+TEST(ThreadPool, DestructorRunsQueuedTasks) {
+  std::atomic<int> count(0);
+  {
+    ThreadPool pool(1);
+    for (int i = 0; i < 100; i++)
+      pool.Submit([&count]() { count++; });
+  }
+  EXPECT_EQ(100, count.load());
+}
+
+TEST(Strand, RunsTasksOneAtATimeInOrder) {
+  ThreadPool pool(4);
+  Strand strand(&pool);
+  std::vector<int> order;
+  std::atomic<int> running(0);
+  std::atomic<bool> overlapped(false);
+  for (int i = 0; i < 200; i++) {
+    strand.Post([&, i]() {
+      if (running++ > 0) overlapped = true;
+      order.push_back(i);
+      running--;
+    });
+  }
+  pool.Wait();
+  EXPECT_EQ(0u, strand.pending());
+  EXPECT_FALSE(overlapped.load());
+  ASSERT_EQ(200u, order.size());
+  for (int i = 0; i < 200; i++)
+    EXPECT_EQ(i, order[i]);
+}
+
+}  // namespace